@@ -8,5 +8,22 @@
 
 #include "dst/tree.hpp"
 #include "dst/aggregate_set.hpp"
+#include "dst/string_tree.hpp"
+#include "dst/radix_tree.hpp"
+#include "dst/adaptive_tree.hpp"
+#include "dst/series_tree.hpp"
+#include "dst/bitset_tree.hpp"
+#include "dst/concurrent_tree.hpp"
+#include "dst/sharded_tree.hpp"
+#include "dst/rcu_tree.hpp"
+#include "dst/atomic_tree.hpp"
+#include "dst/counter_tree.hpp"
+#include "dst/combining_tree.hpp"
+#include "dst/delegated_tree.hpp"
+#include "dst/buffered_tree.hpp"
+#include "dst/snapshot_tree.hpp"
+#include "dst/versioned_tree.hpp"
+#include "dst/mvcc_tree.hpp"
+#include "dst/seqlock_tree.hpp"
 
 #endif
\ No newline at end of file
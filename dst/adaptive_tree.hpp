@@ -0,0 +1,520 @@
+/**
+ * @file adaptive_tree.hpp
+ * @brief Implementation of the dynamic segment tree switching its blocks between sparse and dense representations.
+ */
+
+#ifndef DST_ADAPTIVE_TREE_HPP_
+#define DST_ADAPTIVE_TREE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "bit.hpp"
+#include "key.hpp"
+#include "tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The dynamic segment tree adapting the representation of its blocks to their density and traffic.
+ *
+ * This class offers the interface of tree over aligned blocks of 64 keys, all held in a summary tree. A sparse block has no
+ * storage of its own, its keys being leaves of the summary as in a plain tree, while a dense block holds its values in a
+ * fixed array of 64 slots, under an implicit segment tree of their aggregates, and its aggregate is a single leaf of the
+ * summary, at the first key of the block. Queries thus read the summary for the whole blocks they span and the arrays of
+ * the dense blocks they cut, aggregating only the slots and blocks holding a key. The blocks holding a few keys or more
+ * also track the presence of their keys and a decaying count of the operations touching them, and are converted when they
+ * cross the thresholds below:
+ *
+ * - A sparse block becomes dense once it holds 16 keys, or 8 keys while hot.
+ *
+ * - A dense block becomes sparse once it holds 4 keys or less while cold, or no key at all.
+ *
+ * The gap between the thresholds makes a block go through several operations between two conversions, so that keys moving
+ * back and forth around one threshold do not cause thrashing. The traffic of a block is halved for every 1024 operations on
+ * the tree, and a block is hot when it was touched 32 times within about that window. Queries record their traffic through
+ * atomic counters and stay const, safe to run concurrently as in tree, and the blocks they heat up are converted by the next
+ * modification touching them.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class adaptive_tree {
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	adaptive_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 *
+	 * Queries count as traffic on the tracked blocks holding their endpoints.
+	 *
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Whether the block holding an index is currently stored densely.
+	 * @param index The index to look up.
+	 * @return Whether the block exists and is dense.
+	 */
+	bool dense(const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree by deleting all the blocks.
+	 */
+	void clear();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief Thresholds of the blocks, see the class description.
+	 */
+	static constexpr unsigned _bits = 6;
+	static constexpr std::size_t _dense_count = 16;
+	static constexpr std::size_t _warm_count = 8;
+	static constexpr std::size_t _sparse_count = 4;
+	static constexpr std::size_t _hot_hits = 32;
+	static constexpr unsigned _window = 10;
+
+	/**
+	 * @brief The kinds of writes, see _write.
+	 */
+	enum _kind { _insert, _apply, _erase };
+
+	/**
+	 * @brief The tracking of a block of 64 consecutive keys holding a few of them, with its array once dense.
+	 *
+	 * The presence of the keys is tracked by the block itself so that it is counted without reading the summary. The array
+	 * is an implicit segment tree of 128 slots, the root at 1 and the values of the keys from 64 on, and a slot is empty
+	 * when none of the keys below it is present.
+	 */
+	class block {
+	private:
+		std::unique_ptr<_tvalue[]> _values;
+		std::uint64_t _present;
+		mutable std::atomic<std::size_t> _hits;
+		mutable std::atomic<std::size_t> _stamp;
+
+	public:
+		block() : _present(0), _hits(0), _stamp(0) {}
+
+		bool dense() const { return _values != nullptr; }
+		std::size_t count() const { return bit::popcount(_present); }
+		bool contains(unsigned int position) const { return (_present >> position) & 1; }
+
+		bool filled(unsigned int slot) const {
+			// The keys below a slot are found by shifting it down to the leaves
+			unsigned int level = 0;
+			while((slot << level) < 64) ++level;
+
+			std::uint64_t width = std::uint64_t(1) << level;
+			std::uint64_t mask = (width == 64) ? ~std::uint64_t(0) : ((std::uint64_t(1) << width) - 1) << ((slot << level) - 64);
+			return (_present & mask) != 0;
+		}
+
+		_tvalue* values() const { return _values.get(); }
+
+		std::uint64_t& present() { return _present; }
+		std::atomic<std::size_t>& hits() const { return _hits; }
+		std::atomic<std::size_t>& stamp() const { return _stamp; }
+
+		void densify() { _values.reset(new _tvalue[128]()); }
+		void sparsify() { _values.reset(); }
+	};
+
+	/**
+	 * @brief Hash of the block identifiers, folding keys wider than a word.
+	 */
+	struct hash {
+		std::size_t operator()(const _tkey& id) const {
+			std::uint64_t result = 0;
+			for(std::size_t shift = 0; shift < (sizeof(_tkey) << 3); shift += 64) result ^= std::uint64_t(id >> shift);
+			return std::hash<std::uint64_t>()(result);
+		}
+	};
+
+	/**
+	 * @brief The tracked blocks, by identifier, namely the dense ones and the sparse ones holding a few keys.
+	 */
+	std::unordered_map<_tkey, block, hash> _blocks;
+
+	/**
+	 * @brief The keys of the sparse blocks and the aggregate of every dense block, at the first key of the block.
+	 */
+	tree<_tvalue, _tkey, _functor> _summary;
+
+	/**
+	 * @brief The amount of operations performed on the tree, used to decay the traffic of the blocks.
+	 */
+	mutable std::atomic<std::size_t> _clock;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to give the first key of a block.
+	 */
+	static _tkey _base(const _tkey& id);
+
+	/**
+	 * @brief Internal function to record an operation on a block, telling whether it is hot.
+	 * @param cur The block touched.
+	 * @return Whether the block is hot.
+	 */
+	bool _touch(const block& cur) const;
+
+	/**
+	 * @brief Internal function to write a key of a block, then convert or untrack the block if it crossed a threshold.
+	 * @param target The key written.
+	 * @param value The value written.
+	 * @param kind Whether to insert, apply or erase.
+	 */
+	void _write(const _tkey& target, const _tvalue& value, _kind kind);
+
+	/**
+	 * @brief Internal function to recompute a slot of the array of a dense block from its halves, skipping empty ones.
+	 * @param cur The block.
+	 * @param slot The slot to recompute.
+	 */
+	void _join(block& cur, unsigned int slot);
+
+	/**
+	 * @brief Internal function to aggregate the present keys of a range of positions of a dense block, in key order.
+	 * @param cur The block.
+	 * @param start The first position of the range.
+	 * @param end The last position of the range.
+	 * @param result The aggregate value of the range, left unchanged if there is none.
+	 * @return Whether a key of the range is present.
+	 */
+	bool _fold(const block& cur, unsigned int start, unsigned int end, _tvalue& result) const;
+
+	/**
+	 * @brief Internal function to move the keys of a sparse block from the summary to its array.
+	 * @param id The identifier of the block.
+	 * @param cur The block.
+	 */
+	void _densify(const _tkey& id, block& cur);
+
+	/**
+	 * @brief Internal function to move the keys of a dense block from its array back to the summary.
+	 * @param id The identifier of the block.
+	 * @param cur The block.
+	 */
+	void _sparsify(const _tkey& id, block& cur);
+
+	/**
+	 * @brief Internal function to query a range of positions inside a block, recording the traffic.
+	 * @param id The identifier of the block.
+	 * @param start The first position of the range.
+	 * @param end The last position of the range.
+	 * @param result The aggregate value of the range, left unchanged if there is none.
+	 * @return Whether a key of the range exists.
+	 */
+	bool _query(const _tkey& id, unsigned int start, unsigned int end, _tvalue& result) const;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+adaptive_tree<_tvalue, _tindex, _functor>::adaptive_tree() : _clock(0) {}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void adaptive_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	_write(key<_tindex>::encode(index), value, _insert);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void adaptive_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	_write(key<_tindex>::encode(index), value, _apply);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void adaptive_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	_write(key<_tindex>::encode(index), _tvalue(), _erase);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue adaptive_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	_tkey first = key<_tindex>::encode(start), last = key<_tindex>::encode(end);
+	if(last < first) return _tvalue();
+
+	_tkey low = _tkey(first >> _bits), high = _tkey(last >> _bits);
+	_tvalue result = _tvalue(), part = _tvalue();
+
+	if(low == high) {
+		_query(low, first & 63, last & 63, result);
+		return result;
+	}
+
+	// Partial blocks at both ends, the whole ones in between from the summary, each aggregated only if it holds a key
+	bool found = _query(low, first & 63, 63, result);
+
+	if(_tkey(low + 1) < high && _summary.query(_base(_tkey(low + 1)), _tkey(_base(high) - 1), part)) {
+		result = found ? _func(result, part) : part;
+		found = true;
+	}
+
+	if(_query(high, 0, last & 63, part)) result = found ? _func(result, part) : part;
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue adaptive_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue adaptive_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+	auto found = _blocks.find(_tkey(target >> _bits));
+	if(found == _blocks.end()) return _summary[target];
+
+	_touch(found->second);
+
+	if(!found->second.dense()) return _summary[target];
+	if(!found->second.contains(target & 63)) return _tvalue();
+	return found->second.values()[64 + (target & 63)];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool adaptive_tree<_tvalue, _tindex, _functor>::dense(const _tindex& index) const {
+	auto found = _blocks.find(_tkey(key<_tindex>::encode(index) >> _bits));
+	return found != _blocks.end() && found->second.dense();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void adaptive_tree<_tvalue, _tindex, _functor>::clear() {
+	_blocks.clear();
+	_summary.clear();
+	_clock = 0;
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename adaptive_tree<_tvalue, _tindex, _functor>::_tkey adaptive_tree<_tvalue, _tindex, _functor>::_base(const _tkey& id) {
+	return _tkey(id << _bits);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool adaptive_tree<_tvalue, _tindex, _functor>::_touch(const block& cur) const {
+	// Decay the traffic by the amount of windows elapsed since the block was last touched. Concurrent queries may lose a
+	// few hits, which only delays a conversion.
+	std::size_t now = _clock.fetch_add(1, std::memory_order_relaxed) + 1;
+	std::size_t elapsed = (now - cur.stamp().load(std::memory_order_relaxed)) >> _window;
+	std::size_t hits = (elapsed < 64) ? (cur.hits().load(std::memory_order_relaxed) >> elapsed) + 1 : 1;
+
+	cur.hits().store(hits, std::memory_order_relaxed);
+	cur.stamp().store(now, std::memory_order_relaxed);
+	return hits >= _hot_hits;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void adaptive_tree<_tvalue, _tindex, _functor>::_write(const _tkey& target, const _tvalue& value, _kind kind) {
+	_tkey id = _tkey(target >> _bits);
+	unsigned int position = target & 63;
+	auto found = _blocks.find(id);
+
+	if(found == _blocks.end()) { // Untracked, the keys live in the summary only
+		if(kind == _insert) _summary.insert(target, value);
+		else if(kind == _apply) _summary.apply(target, value);
+		else {
+			_summary.erase(target);
+			return;
+		}
+
+		// Track the block once it holds a few keys
+		std::uint64_t present = 0;
+		_summary.for_each(_base(id), _tkey(_base(id) | 63), [&present](const _tkey& index, const _tvalue&) {
+			present |= std::uint64_t(1) << (index & 63);
+		});
+
+		if(std::size_t(bit::popcount(present)) < _warm_count) return;
+
+		found = _blocks.emplace(std::piecewise_construct, std::forward_as_tuple(id), std::forward_as_tuple()).first;
+		found->second.present() = present;
+	}
+	else {
+		block& cur = found->second;
+		std::uint64_t mask = std::uint64_t(1) << position;
+
+		if(cur.dense()) {
+			_tvalue& leaf = cur.values()[64 + position];
+
+			if(kind == _insert) leaf = value;
+			else if(kind == _apply) leaf = cur.contains(position) ? _func(leaf, value) : value;
+		}
+		else {
+			if(kind == _insert) _summary.insert(target, value);
+			else if(kind == _apply) _summary.apply(target, value);
+			else _summary.erase(target);
+		}
+
+		if(kind == _erase) cur.present() &= ~mask;
+		else cur.present() |= mask;
+
+		if(cur.dense()) {
+			for(unsigned int slot = (64 + position) >> 1; slot > 0; slot >>= 1) _join(cur, slot);
+
+			if(cur.count() == 0) _summary.erase(_base(id));
+			else _summary.insert(_base(id), cur.values()[1]);
+		}
+	}
+
+	block& cur = found->second;
+	std::size_t count = cur.count();
+	bool hot = _touch(cur);
+
+	if(!cur.dense() && (count >= _dense_count || (hot && count >= _warm_count))) _densify(id, cur);
+	else if(cur.dense() && (count == 0 || (!hot && count <= _sparse_count))) _sparsify(id, cur);
+
+	if(!cur.dense() && count <= _sparse_count) _blocks.erase(found);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void adaptive_tree<_tvalue, _tindex, _functor>::_join(block& cur, unsigned int slot) {
+	unsigned int left = slot << 1, right = slot << 1 | 1;
+	bool lhs = cur.filled(left), rhs = cur.filled(right);
+
+	if(lhs && rhs) cur.values()[slot] = _func(cur.values()[left], cur.values()[right]);
+	else if(lhs) cur.values()[slot] = cur.values()[left];
+	else if(rhs) cur.values()[slot] = cur.values()[right];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool adaptive_tree<_tvalue, _tindex, _functor>::_fold(const block& cur, unsigned int start, unsigned int end, _tvalue& result) const {
+	// Bottom-up as in flat_tree, with separate accumulators to keep the key order
+	_tvalue left = _tvalue(), right = _tvalue();
+	bool lhs = false, rhs = false;
+
+	for(start += 64, end += 65; start < end; start >>= 1, end >>= 1) {
+		if(start & 1) {
+			if(cur.filled(start)) {
+				left = lhs ? _func(left, cur.values()[start]) : cur.values()[start];
+				lhs = true;
+			}
+
+			++start;
+		}
+
+		if(end & 1) {
+			--end;
+
+			if(cur.filled(end)) {
+				right = rhs ? _func(cur.values()[end], right) : cur.values()[end];
+				rhs = true;
+			}
+		}
+	}
+
+	if(lhs && rhs) result = _func(left, right);
+	else if(lhs) result = left;
+	else if(rhs) result = right;
+
+	return lhs || rhs;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void adaptive_tree<_tvalue, _tindex, _functor>::_densify(const _tkey& id, block& cur) {
+	cur.densify();
+
+	for(std::uint64_t rest = cur.present(); rest; rest &= rest - 1) {
+		unsigned int position = (unsigned int)bit::ctz(rest);
+		_tkey target = _tkey(_base(id) | position);
+
+		cur.values()[64 + position] = _summary[target];
+		_summary.erase(target);
+	}
+
+	for(unsigned int slot = 63; slot > 0; --slot) _join(cur, slot);
+	_summary.insert(_base(id), cur.values()[1]);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void adaptive_tree<_tvalue, _tindex, _functor>::_sparsify(const _tkey& id, block& cur) {
+	_summary.erase(_base(id));
+
+	for(std::uint64_t rest = cur.present(); rest; rest &= rest - 1) {
+		unsigned int position = (unsigned int)bit::ctz(rest);
+		_summary.insert(_tkey(_base(id) | position), cur.values()[64 + position]);
+	}
+
+	cur.sparsify();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool adaptive_tree<_tvalue, _tindex, _functor>::_query(const _tkey& id, unsigned int start, unsigned int end, _tvalue& result) const {
+	auto found = _blocks.find(id);
+
+	if(found != _blocks.end()) {
+		_touch(found->second);
+		if(found->second.dense()) return _fold(found->second, start, end, result);
+	}
+
+	return _summary.query(_tkey(_base(id) | start), _tkey(_base(id) | end), result);
+}
+
+}
+
+#endif
@@ -61,7 +61,7 @@ public:
 	 * @brief Aggregate the whole set.
 	 * @return The aggregate value of all the values of the set.
 	 */
-	_tvalue all() {
+	_tvalue all() const {
 		return _tree.query(std::make_pair(std::numeric_limits<_tindex>::min(), std::numeric_limits<_tindex>::max()));
 	}
 };
@@ -82,7 +82,7 @@ public:
 		_tree.erase(value);
 	}
 
-	_tvalue all() {
+	_tvalue all() const {
 		return _tree.query(std::make_pair(std::numeric_limits<_tvalue>::min(), std::numeric_limits<_tvalue>::max()));
 	}
 };
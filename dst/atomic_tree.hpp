@@ -0,0 +1,400 @@
+/**
+ * @file atomic_tree.hpp
+ * @brief Implementation of the lock-free segment tree for concurrent insertions under a commutative functor.
+ */
+
+#ifndef DST_ATOMIC_TREE_HPP_
+#define DST_ATOMIC_TREE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "bit.hpp"
+#include "key.hpp"
+
+namespace dst {
+
+/**
+ * @brief The lock-free segment tree, where any amount of threads insert and apply at once.
+ *
+ * The nodes of tree are rearranged by every insertion that extends a range, which cannot be done with single atomic
+ * operations. This class therefore keeps every node at a fixed place instead, in a trie of 16 children per level over the
+ * bits of the keys, where single-child chains are skipped: a leaf hangs from the deepest branch its key shares with
+ * another, and a branch is only created where two keys part. A writer walks down from the root and links its leaf by
+ * compare-and-swap, either in an empty slot or together with the node found there under a new branch at the level where
+ * both part, the losing thread deleting its copy and retrying from the same branch. It then combines the value into the
+ * aggregate of the branches of its path, each with a compare-and-swap loop. No thread ever waits for another.
+ *
+ * A branch linked between two nodes could not learn about the writes already on their way through the node it displaced,
+ * so it inherits that node as a child: its aggregate holds the writes through its other children only, and the total of a
+ * branch is its aggregate combined with the total of its inherited child. Writers thus skip the aggregate of a branch when
+ * going through its inherited child, and a write is counted exactly once whether its path was read before or after a split.
+ * Two keys cost a branch or two instead of a full path of branches per key.
+ *
+ * The functor must be commutative as well as associative, since the contributions reach the aggregates in any order, and
+ * the values must be trivially copyable to be held in std::atomic. A query running during writes sees every write at most
+ * once, either whole or not at all for each part of its range. Indices cannot be erased, as undoing a contribution would
+ * need an inverse of the functor.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The commutative functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class atomic_tree {
+	static_assert(std::is_trivially_copyable<_tvalue>::value, "The value type must be trivially copyable");
+
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	atomic_tree();
+
+	atomic_tree(const atomic_tree&) = delete;
+	atomic_tree& operator=(const atomic_tree&) = delete;
+
+	/**
+	 * @brief Insert a value at a given index in the tree, if the index is not there yet.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 * @return Whether the value was inserted, which fails if the index already exists.
+	 */
+	bool insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree, inserting the index if needed.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree, which must not run concurrently with any other call.
+	 */
+	void clear();
+
+	/**
+	 * @brief Destructor for the tree.
+	 */
+	~atomic_tree();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The amount of key bits consumed by a level, the amount of children of a branch, and the amount of levels.
+	 */
+	static constexpr unsigned _width = 4;
+	static constexpr std::size_t _fanout = std::size_t(1) << _width;
+	static constexpr unsigned _bits = sizeof(_tkey) << 3;
+	static constexpr unsigned _depth = _bits / _width;
+
+	/**
+	 * @brief A node of the tree, which is a leaf holding its key at level _depth, or a branch holding its prefix.
+	 */
+	struct node {
+		std::atomic<_tvalue> value;
+		const _tkey key;
+		const unsigned level;
+
+		node(const _tvalue& init, const _tkey& index, unsigned depth) : value(init), key(index), level(depth) {}
+	};
+
+	/**
+	 * @brief A branch, with a child for every digit of its level, one of which may be inherited.
+	 */
+	struct branch : node {
+		std::atomic<node*> children[_fanout];
+		const std::size_t inherit;
+
+		branch(const _tvalue& init, const _tkey& prefix, unsigned depth, std::size_t digit = _fanout)
+			: node(init, prefix, depth), inherit(digit) {
+
+			for(std::atomic<node*>& child : children) child.store(nullptr, std::memory_order_relaxed);
+		}
+	};
+
+	/**
+	 * @brief The root of the tree, covering every key, without any inherited child.
+	 */
+	branch* _root;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to give the digit of a key at a level.
+	 */
+	static std::size_t _digit(const _tkey& index, unsigned level) {
+		return std::size_t(index >> (_bits - _width * (level + 1))) & (_fanout - 1);
+	}
+
+	/**
+	 * @brief Internal function to give the bits of the keys free below a level.
+	 */
+	static _tkey _mask(unsigned level) {
+		return level == 0 ? _tkey(~_tkey(0)) : _tkey((_tkey(1) << (_bits - _width * level)) - 1);
+	}
+
+	/**
+	 * @brief Internal function to give the level at which two different keys part.
+	 */
+	static unsigned _part(const _tkey& a, const _tkey& b) {
+		return unsigned(_bits - 1 - bit::log(_tkey(a ^ b))) / _width;
+	}
+
+	/**
+	 * @brief Internal function to aggregate a value to an atomic one.
+	 * @param target The atomic value.
+	 * @param value The value to aggregate.
+	 */
+	void _combine(std::atomic<_tvalue>& target, const _tvalue& value) const;
+
+	/**
+	 * @brief Internal function to insert or aggregate a value at a given key.
+	 * @param index The key to insert the value.
+	 * @param value The value to insert.
+	 * @param combine Whether to aggregate the value to an existing one instead of failing.
+	 * @return Whether the value reached the tree.
+	 */
+	bool _insert(const _tkey& index, const _tvalue& value, bool combine);
+
+	/**
+	 * @brief Internal function to query the aggregate value of a range of keys.
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue _query(const node* cur, const std::pair<_tkey, _tkey>& segment) const;
+
+	/**
+	 * @brief Internal function to give the total of a node, following the chain of inherited children.
+	 * @param cur The node.
+	 * @return The aggregate value of the subtree.
+	 */
+	_tvalue _total(const node* cur) const;
+
+	/**
+	 * @brief Internal function to delete a subtree.
+	 * @param cur The current node.
+	 */
+	void _clear(node* cur);
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+atomic_tree<_tvalue, _tindex, _functor>::atomic_tree() : _root(new branch(_tvalue(), 0, 0)) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+atomic_tree<_tvalue, _tindex, _functor>::~atomic_tree() {
+	_clear(_root);
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool atomic_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	return _insert(key<_tindex>::encode(index), value, false);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void atomic_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	_insert(key<_tindex>::encode(index), value, true);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue atomic_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	_tkey first = key<_tindex>::encode(start), last = key<_tindex>::encode(end);
+	if(last < first) return _tvalue();
+
+	return _query(_root, std::make_pair(first, last));
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue atomic_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue atomic_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+	const node* cur = _root;
+
+	while(cur != nullptr && cur->level < _depth) {
+		if(_tkey((target ^ cur->key) & ~_mask(cur->level)) != 0) return _tvalue(); // Parted above this branch
+		cur = static_cast<const branch*>(cur)->children[_digit(target, cur->level)].load(std::memory_order_acquire);
+	}
+
+	return (cur == nullptr || cur->key != target) ? _tvalue() : cur->value.load(std::memory_order_acquire);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void atomic_tree<_tvalue, _tindex, _functor>::clear() {
+	_clear(_root);
+	_root = new branch(_tvalue(), 0, 0);
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void atomic_tree<_tvalue, _tindex, _functor>::_combine(std::atomic<_tvalue>& target, const _tvalue& value) const {
+	_tvalue expected = target.load(std::memory_order_relaxed);
+	while(!target.compare_exchange_weak(expected, _func(expected, value), std::memory_order_acq_rel, std::memory_order_relaxed));
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool atomic_tree<_tvalue, _tindex, _functor>::_insert(const _tkey& index, const _tvalue& value, bool combine) {
+	branch* path[_depth];
+	std::size_t digits[_depth];
+	unsigned steps = 0;
+	branch* cur = _root;
+
+	// Walk down the branches sharing the prefix of the key, until the leaf is linked or found
+	while(true) {
+		std::size_t digit = _digit(index, cur->level);
+		std::atomic<node*>& link = cur->children[digit];
+		node* next = link.load(std::memory_order_acquire);
+
+		if(next != nullptr && next->level < _depth && _tkey((index ^ next->key) & ~_mask(next->level)) == 0) {
+			path[steps] = cur;
+			digits[steps++] = digit;
+			cur = static_cast<branch*>(next);
+			continue;
+		}
+
+		if(next != nullptr && next->key == index && next->level == _depth) { // Already there
+			if(!combine) return false;
+
+			_combine(next->value, value);
+			path[steps] = cur;
+			digits[steps++] = digit;
+			break;
+		}
+
+		node* leaf = new node(value, index, _depth);
+		node* created = leaf;
+		branch* fork = nullptr;
+
+		if(next != nullptr) { // Part from the node found under a new branch inheriting it
+			unsigned level = _part(index, next->key);
+			std::size_t kept = _digit(next->key, level);
+
+			fork = new branch(value, _tkey(index & ~_mask(level)), level, kept);
+			fork->children[kept].store(next, std::memory_order_relaxed);
+			fork->children[_digit(index, level)].store(leaf, std::memory_order_relaxed);
+			created = fork;
+		}
+
+		if(link.compare_exchange_strong(next, created, std::memory_order_acq_rel, std::memory_order_acquire)) {
+			path[steps] = cur;
+			digits[steps++] = digit;
+			break;
+		}
+
+		// Another thread changed the slot first, retry from the same branch
+		delete fork;
+		delete leaf;
+	}
+
+	for(unsigned step = 0; step < steps; ++step)
+		if(digits[step] != path[step]->inherit) _combine(path[step]->value, value);
+
+	return true;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue atomic_tree<_tvalue, _tindex, _functor>::_query(const node* cur, const std::pair<_tkey, _tkey>& segment) const {
+	if(cur == nullptr) return _tvalue();
+
+	if(cur->level == _depth)
+		return (segment.first <= cur->key && cur->key <= segment.second) ? cur->value.load(std::memory_order_acquire) : _tvalue();
+
+	// The branch covers the keys from its prefix on, with all the bits below its level free
+	_tkey mask = _mask(cur->level);
+
+	if(segment.first <= cur->key && _tkey(cur->key | mask) <= segment.second)
+		return _total(cur);
+
+	if(segment.second < cur->key || _tkey(cur->key | mask) < segment.first)
+		return _tvalue();
+
+	const branch* parent = static_cast<const branch*>(cur);
+	_tvalue result = _tvalue();
+
+	for(std::size_t digit = 0; digit < _fanout; ++digit) {
+		const node* child = parent->children[digit].load(std::memory_order_acquire);
+		if(child != nullptr) result = _func(result, _query(child, segment));
+	}
+
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue atomic_tree<_tvalue, _tindex, _functor>::_total(const node* cur) const {
+	_tvalue result = cur->value.load(std::memory_order_acquire);
+
+	while(cur->level < _depth) {
+		const branch* parent = static_cast<const branch*>(cur);
+		if(parent->inherit == _fanout) break;
+
+		cur = parent->children[parent->inherit].load(std::memory_order_acquire);
+		result = _func(result, cur->value.load(std::memory_order_acquire));
+	}
+
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void atomic_tree<_tvalue, _tindex, _functor>::_clear(node* cur) {
+	if(cur == nullptr) return;
+
+	if(cur->level == _depth) {
+		delete cur;
+		return;
+	}
+
+	branch* parent = static_cast<branch*>(cur);
+	for(std::atomic<node*>& child : parent->children) _clear(child.load(std::memory_order_relaxed));
+	delete parent;
+}
+
+}
+
+#endif
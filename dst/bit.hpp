@@ -6,8 +6,35 @@
 
 namespace dst {
 
+#ifdef __SIZEOF_INT128__
+
+/**
+ * @brief The 128-bit integers of GCC and Clang, declared once as extensions so that strict pedantic builds stay quiet.
+ */
+__extension__ typedef __int128 int128;
+__extension__ typedef unsigned __int128 uint128;
+
+#endif
+
 namespace bit {
 
+/**
+ * @brief Whether a type is an integral word the bit utilities accept, which includes the 128-bit integers of GCC and Clang
+ * even in strict standard modes where std::is_integral rejects them.
+ */
+template<typename _type>
+struct integral : std::is_integral<_type> {};
+
+#ifdef __SIZEOF_INT128__
+
+template<>
+struct integral<int128> : std::true_type {};
+
+template<>
+struct integral<uint128> : std::true_type {};
+
+#endif
+
 static constexpr unsigned char lookup[256] = {
 	0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
 	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
@@ -27,7 +54,35 @@ static constexpr unsigned char lookup[256] = {
 	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7
 };
 
-#if __cplusplus >= 201703L
+#if defined(__GNUC__) || defined(__clang__)
+
+template<typename _type>
+inline constexpr typename std::enable_if<integral<_type>::value && sizeof(_type) <= sizeof(unsigned int), std::size_t>::type
+log(_type value) {
+	return value ? (sizeof(unsigned int) << 3) - 1 - __builtin_clz((unsigned int)(typename std::make_unsigned<_type>::type)(value)) : 0;
+}
+
+template<typename _type>
+inline constexpr typename std::enable_if<integral<_type>::value && sizeof(unsigned int) < sizeof(_type) &&
+	sizeof(_type) <= sizeof(unsigned long long), std::size_t>::type
+log(_type value) {
+	return value ? (sizeof(unsigned long long) << 3) - 1 - __builtin_clzll((unsigned long long)(value)) : 0;
+}
+
+#ifdef __SIZEOF_INT128__
+
+template<typename _type>
+inline constexpr typename std::enable_if<integral<_type>::value && sizeof(unsigned long long) < sizeof(_type), std::size_t>::type
+log(_type value) {
+	// Word-wise, the high word decides unless it is empty
+	return ((uint128)(value) >> 64)
+		? 64 + log((unsigned long long)((uint128)(value) >> 64))
+		: log((unsigned long long)(value));
+}
+
+#endif
+
+#elif __cplusplus >= 201703L
 
 template<typename _type, std::size_t _width = (sizeof(_type) - 1) << 3>
 inline constexpr std::enable_if_t<std::is_integral_v<_type>, std::size_t>
@@ -63,19 +118,59 @@ log(_type value) {
 
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+
+template<typename _type>
+inline constexpr typename std::enable_if<integral<_type>::value && sizeof(_type) <= sizeof(unsigned long long), std::size_t>::type
+popcount(_type value) {
+	return __builtin_popcountll((unsigned long long)(typename std::make_unsigned<_type>::type)(value));
+}
+
+template<typename _type>
+inline constexpr typename std::enable_if<integral<_type>::value && sizeof(_type) <= sizeof(unsigned long long), std::size_t>::type
+ctz(_type value) {
+	return value ? __builtin_ctzll((unsigned long long)(value)) : sizeof(_type) << 3;
+}
+
+#else
+
 template<typename _type>
-inline constexpr typename std::enable_if<std::is_integral<_type>::value, std::size_t>::type
+inline typename std::enable_if<integral<_type>::value, std::size_t>::type
+popcount(_type value) {
+	std::size_t result = 0;
+	for(; value; value &= value - 1) ++result;
+	return result;
+}
+
+template<typename _type>
+inline typename std::enable_if<integral<_type>::value, std::size_t>::type
+ctz(_type value) {
+	// The lowest set bit is isolated by the two's complement, then located like the highest one
+	return value ? log(_type(value & (~value + 1))) : sizeof(_type) << 3;
+}
+
+#endif
+
+template<typename _type>
+inline constexpr typename std::enable_if<integral<_type>::value, _type>::type
 msb(_type value) {
-	return std::size_t(1) << log(value);
+	return _type(_type(1) << log(value));
 }
 
 template<typename _type>
-inline constexpr typename std::enable_if<std::is_integral<_type>::value, std::size_t>::type
+inline constexpr typename std::enable_if<integral<_type>::value, _type>::type
 segment_size(_type start, _type end) {
 	// Assume half-open range
 	return msb((end - 1) ^ start) << 1;
 }
 
+template<typename _type>
+inline constexpr typename std::enable_if<integral<_type>::value, _type>::type
+block(_type first, _type second) {
+	// Mask of the smallest aligned block holding both values, shifted in two steps so the widest block does not overflow
+	return _type(((_type(1) << log(_type(first ^ second))) << 1) - 1);
+}
+
 } // namespace bit
 
 } // namespace dst
@@ -0,0 +1,312 @@
+/**
+ * @file bitset_tree.hpp
+ * @brief Implementation of the presence set of indices, counting its members with popcount.
+ */
+
+#ifndef DST_BITSET_TREE_HPP_
+#define DST_BITSET_TREE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include "bit.hpp"
+#include "key.hpp"
+#include "tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The presence set of indices, storing bits instead of values.
+ *
+ * This class replaces a tree of 0/1 values used for membership. The indices are grouped by aligned blocks of 512 keys, each
+ * stored as 8 words of presence bits, and a tree over the non-empty blocks aggregates their popcount. Counting a range
+ * masks the words of the blocks at both ends and asks the tree for the whole blocks in between. The set supports the
+ * following operations:
+ *
+ * - Insertion and deletion of an index.
+ *
+ * - Count of the indices in a range, and rank of an index among the members.
+ *
+ * - Select of the member of a given rank, and the next member from an index on, through a descent of the tree.
+ *
+ * @tparam _tindex The type of the indices used in the set, with the same requirements as in tree.
+ */
+template<typename _tindex>
+class bitset_tree {
+public:
+	/**
+	 * @brief Constructor for the set.
+	 */
+	bitset_tree();
+
+	/**
+	 * @brief Insert an index into the set.
+	 * @param index The index to insert.
+	 */
+	void insert(const _tindex& index);
+
+	/**
+	 * @brief Remove an index from the set.
+	 * @param index The index to remove.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Whether an index is in the set.
+	 * @param index The index to look for.
+	 */
+	bool contains(const _tindex& index) const;
+
+	/**
+	 * @brief The amount of indices in the set.
+	 */
+	std::size_t count() const;
+
+	/**
+	 * @brief The amount of indices of the set in the given range. The range is inclusive.
+	 * @param start The start of the range.
+	 * @param end The end of the range.
+	 * @return The amount of indices in the range.
+	 */
+	std::size_t count(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief The amount of indices of the set below a given index.
+	 * @param index The index to rank.
+	 * @return The amount of indices below the index.
+	 */
+	std::size_t rank(const _tindex& index) const;
+
+	/**
+	 * @brief Find the index of the set of a given rank, counting from 0.
+	 * @param rank The rank of the index.
+	 * @param index The index found, left unchanged if there is none.
+	 * @return Whether the set holds more indices than the rank.
+	 */
+	bool select(std::size_t rank, _tindex& index) const;
+
+	/**
+	 * @brief Find the first index of the set not less than a given index.
+	 * @param start The index to start from.
+	 * @param index The index found, left unchanged if there is none.
+	 * @return Whether there is such an index.
+	 */
+	bool next(const _tindex& start, _tindex& index) const;
+
+	/**
+	 * @brief Clear the set by releasing every block.
+	 */
+	void clear();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The amount of key bits addressing a position inside a block, and the amount of words of a block.
+	 */
+	static constexpr unsigned _bits = 9;
+	static constexpr std::size_t _words = 8;
+
+	/**
+	 * @brief The presence bits of a block of 512 consecutive keys.
+	 */
+	using block = std::array<std::uint64_t, _words>;
+
+	/**
+	 * @brief Hash of the block identifiers, folding keys wider than a word.
+	 */
+	struct hash {
+		std::size_t operator()(const _tkey& id) const {
+			std::uint64_t result = 0;
+			for(std::size_t shift = 0; shift < (sizeof(_tkey) << 3); shift += 64) result ^= std::uint64_t(id >> shift);
+			return std::hash<std::uint64_t>()(result);
+		}
+	};
+
+	/**
+	 * @brief The non-empty blocks, by identifier.
+	 */
+	std::unordered_map<_tkey, block, hash> _blocks;
+
+	/**
+	 * @brief The popcount of every non-empty block, by identifier.
+	 */
+	tree<std::size_t, _tkey> _summary;
+
+	/**
+	 * @brief The amount of indices in the set.
+	 */
+	std::size_t _count;
+
+	/**
+	 * @brief Internal function to count the indices of the set in a range of keys. The range is inclusive.
+	 * @param first The first key of the range.
+	 * @param last The last key of the range.
+	 * @return The amount of indices in the range.
+	 */
+	std::size_t _range(const _tkey& first, const _tkey& last) const;
+
+	/**
+	 * @brief Internal function to count the bits of a block between two positions. The range is inclusive.
+	 * @param id The identifier of the block.
+	 * @param start The first position of the range.
+	 * @param end The last position of the range.
+	 * @return The amount of bits set in the range.
+	 */
+	std::size_t _partial(const _tkey& id, unsigned int start, unsigned int end) const;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tindex>
+bitset_tree<_tindex>::bitset_tree() : _count(0) {}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tindex>
+void bitset_tree<_tindex>::insert(const _tindex& index) {
+	_tkey target = key<_tindex>::encode(index), id = _tkey(target >> _bits);
+	block& cur = _blocks[id];
+
+	std::uint64_t& word = cur[(target >> 6) & (_words - 1)];
+	std::uint64_t mask = std::uint64_t(1) << (target & 63);
+	if(word & mask) return;
+
+	word |= mask;
+	++_count;
+	_summary.apply(id, 1);
+}
+
+template<typename _tindex>
+void bitset_tree<_tindex>::erase(const _tindex& index) {
+	_tkey target = key<_tindex>::encode(index), id = _tkey(target >> _bits);
+
+	auto found = _blocks.find(id);
+	if(found == _blocks.end()) return;
+
+	std::uint64_t& word = found->second[(target >> 6) & (_words - 1)];
+	std::uint64_t mask = std::uint64_t(1) << (target & 63);
+	if(!(word & mask)) return;
+
+	word &= ~mask;
+	--_count;
+
+	std::size_t remaining = 0;
+	for(std::uint64_t bits : found->second) remaining += bit::popcount(bits);
+
+	if(remaining == 0) {
+		_blocks.erase(found);
+		_summary.erase(id);
+	}
+	else _summary.insert(id, remaining);
+}
+
+template<typename _tindex>
+bool bitset_tree<_tindex>::contains(const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+
+	auto found = _blocks.find(_tkey(target >> _bits));
+	if(found == _blocks.end()) return false;
+
+	return (found->second[(target >> 6) & (_words - 1)] >> (target & 63)) & 1;
+}
+
+template<typename _tindex>
+std::size_t bitset_tree<_tindex>::count() const {
+	return _count;
+}
+
+template<typename _tindex>
+std::size_t bitset_tree<_tindex>::count(const _tindex& start, const _tindex& end) const {
+	return _range(key<_tindex>::encode(start), key<_tindex>::encode(end));
+}
+
+template<typename _tindex>
+std::size_t bitset_tree<_tindex>::rank(const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+	if(target == 0) return 0;
+	return _range(0, _tkey(target - 1));
+}
+
+template<typename _tindex>
+bool bitset_tree<_tindex>::select(std::size_t rank, _tindex& index) const {
+	if(rank >= _count) return false;
+
+	// The block holding the index is the first one at which the running popcount exceeds the rank
+	_tkey id = 0;
+	_summary.search([rank](std::size_t total) { return total > rank; }, id);
+	if(id > 0) rank -= _summary.query(0, _tkey(id - 1));
+
+	const block& cur = _blocks.find(id)->second;
+	std::size_t word = 0;
+
+	for(; bit::popcount(cur[word]) <= rank; ++word) rank -= bit::popcount(cur[word]);
+
+	// Drop the lower bits of the word until the wanted one is the lowest
+	std::uint64_t bits = cur[word];
+	for(; rank > 0; --rank) bits &= bits - 1;
+
+	index = key<_tindex>::decode(_tkey((_tkey(id) << _bits) | _tkey(word << 6) | _tkey(bit::ctz(bits))));
+	return true;
+}
+
+template<typename _tindex>
+bool bitset_tree<_tindex>::next(const _tindex& start, _tindex& index) const {
+	return select(rank(start), index);
+}
+
+template<typename _tindex>
+void bitset_tree<_tindex>::clear() {
+	_blocks.clear();
+	_summary.clear();
+	_count = 0;
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tindex>
+std::size_t bitset_tree<_tindex>::_range(const _tkey& first, const _tkey& last) const {
+	if(last < first) return 0;
+
+	_tkey low = _tkey(first >> _bits), high = _tkey(last >> _bits);
+	unsigned int mask = (1u << _bits) - 1;
+	if(low == high) return _partial(low, first & mask, last & mask);
+
+	// Partial blocks at both ends, the whole ones in between from the summary
+	std::size_t result = _partial(low, first & mask, mask) + _partial(high, 0, last & mask);
+	if(_tkey(low + 1) < high) result += _summary.query(_tkey(low + 1), _tkey(high - 1));
+	return result;
+}
+
+template<typename _tindex>
+std::size_t bitset_tree<_tindex>::_partial(const _tkey& id, unsigned int start, unsigned int end) const {
+	auto found = _blocks.find(id);
+	if(found == _blocks.end()) return 0;
+
+	std::size_t result = 0;
+
+	for(unsigned int word = start >> 6; word <= end >> 6; ++word) {
+		std::uint64_t bits = found->second[word];
+		if(word == start >> 6) bits &= ~std::uint64_t(0) << (start & 63);
+		if(word == end >> 6 && (end & 63) < 63) bits &= (std::uint64_t(1) << ((end & 63) + 1)) - 1;
+		result += bit::popcount(bits);
+	}
+
+	return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,432 @@
+/**
+ * @file buffered_tree.hpp
+ * @brief Implementation of the dynamic segment tree whose deltas are buffered per thread and merged in batches.
+ */
+
+#ifndef DST_BUFFERED_TREE_HPP_
+#define DST_BUFFERED_TREE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "key.hpp"
+#include "rw_lock.hpp"
+#include "tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The buffered tree, a shared tree fed by deltas accumulated in a buffer of every writing thread.
+ *
+ * The deltas given to apply are aggregated with the functor into a buffer owned by the calling thread, keyed by index,
+ * without touching the shared tree. The buffer is locked with a mutex of its own, which stays on the cache of its thread,
+ * since no other thread takes it but to flush. Once the buffer holds a given amount of indices, or a given time has passed
+ * since its last merge, which is only checked every few deltas, the next delta merges it into the shared tree as one batch
+ * of tree, under the exclusive side of a rw_lock.
+ *
+ * Queries read the shared tree, thus only seeing the merged deltas, unless they ask for the flushed level, which first merges
+ * the buffers of every thread. The buffer of a thread that stops applying keeps its deltas until the next merge of its own
+ * or the next flush, and the deltas still buffered when the tree is destroyed are dropped with it. The buffers are owned by
+ * the tree, the threads only holding weak references to them, which they forget once the tree is gone, and the buffer of a
+ * finished thread is dropped once empty, by the next flush or the first delta of another thread. Insertions and
+ * erasures merge the buffer of the calling thread first, so the writes of a thread take effect in the order it issued them,
+ * those of different threads in any order.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class buffered_tree {
+public:
+	/**
+	 * @brief The levels of consistency of a query.
+	 */
+	enum level {
+		merged,  ///< Only the merged deltas are seen, without waiting for the writers.
+		flushed  ///< Every delta applied before the query is seen.
+	};
+
+	/**
+	 * @brief Constructor for the tree.
+	 * @param capacity The amount of buffered indices triggering a merge.
+	 * @param interval The time since the last merge of a buffer triggering the next one.
+	 */
+	explicit buffered_tree(std::size_t capacity = 1024, std::chrono::milliseconds interval = std::chrono::milliseconds(10));
+
+	buffered_tree(const buffered_tree&) = delete;
+	buffered_tree& operator=(const buffered_tree&) = delete;
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree, through the buffer of the calling thread.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Merge the buffers of every thread into the tree.
+	 */
+	void flush();
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @param consistency The deltas to be seen by the query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end, level consistency = merged) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @param consistency The deltas to be seen by the query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range, level consistency = merged) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @param consistency The deltas to be seen by the access.
+	 * @return The value at the index.
+	 */
+	_tvalue at(const _tindex& index, level consistency = merged) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree, only seeing the merged deltas.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree and the buffers.
+	 */
+	void clear();
+
+	/**
+	 * @brief Destructor for the tree, dropping the deltas left in the buffers.
+	 */
+	~buffered_tree();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The operations performed by the tree.
+	 */
+	using operation = typename tree<_tvalue, _tindex, _functor>::operation;
+
+	/**
+	 * @brief The amount of deltas between two reads of the clock by a buffer.
+	 */
+	static constexpr std::size_t _period = 64;
+
+	/**
+	 * @brief The hash of the keys, folding the wide ones into 64 bits.
+	 */
+	struct hash {
+		std::size_t operator()(const _tkey& id) const {
+			std::uint64_t result = 0;
+			for(std::size_t shift = 0; shift < (sizeof(_tkey) << 3); shift += 64) result ^= std::uint64_t(id >> shift);
+			return std::hash<std::uint64_t>()(result);
+		}
+	};
+
+	/**
+	 * @brief The buffer of a thread, with a reference to a token of the thread, which expires once the thread is over.
+	 */
+	struct buffer {
+		std::mutex lock;
+		std::unordered_map<_tkey, _tvalue, hash> deltas;
+		std::chrono::steady_clock::time_point merged;
+		std::size_t applied;
+		std::weak_ptr<void> owner;
+	};
+
+	/**
+	 * @brief The shared tree, merged into by the flushing queries as well.
+	 */
+	mutable tree<_tvalue, _tindex, _functor> _tree;
+
+	/**
+	 * @brief The lock guarding the shared tree, always taken before the lock of a buffer.
+	 */
+	mutable rw_lock _lock;
+
+	/**
+	 * @brief The buffers of the threads which applied a delta, only owned by the tree, and the mutex guarding the list.
+	 */
+	mutable std::vector<std::shared_ptr<buffer>> _buffers;
+	mutable std::mutex _registry;
+
+	/**
+	 * @brief The merge thresholds.
+	 */
+	std::size_t _capacity;
+	std::chrono::milliseconds _interval;
+
+	/**
+	 * @brief The identifier of the tree, never reused, under which the threads find their buffer.
+	 */
+	std::size_t _id;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to give the buffer of the calling thread, created on its first delta.
+	 */
+	buffer& _local();
+
+	/**
+	 * @brief Internal function to move the deltas of a buffer into a batch, with the locks of the buffer and tree held.
+	 * @param cur The buffer.
+	 * @param batch The operations of the batch.
+	 */
+	static void _drain(buffer& cur, std::vector<operation>& batch);
+
+	/**
+	 * @brief Internal function to merge every buffer, with the exclusive lock of the tree held.
+	 */
+	void _flush() const;
+
+	/**
+	 * @brief Internal function to drop the empty buffers of the finished threads, with the registry mutex held.
+	 */
+	void _prune() const;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+buffered_tree<_tvalue, _tindex, _functor>::buffered_tree(std::size_t capacity, std::chrono::milliseconds interval)
+	: _capacity(capacity), _interval(interval) {
+
+	static std::atomic<std::size_t> next(0);
+	_id = next.fetch_add(1, std::memory_order_relaxed);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+buffered_tree<_tvalue, _tindex, _functor>::~buffered_tree() {
+	// Releasing the buffers expires the references of the threads
+	std::lock_guard<std::mutex> registry(_registry);
+	_buffers.clear();
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void buffered_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	buffer& mine = _local();
+	std::vector<operation> batch;
+
+	std::lock_guard<rw_lock> guard(_lock);
+	std::lock_guard<std::mutex> local(mine.lock);
+
+	_drain(mine, batch);
+	batch.push_back(operation{operation::insert, index, value});
+	_tree.batch(batch.begin(), batch.end());
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void buffered_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	buffer& mine = _local();
+
+	{
+		std::lock_guard<std::mutex> local(mine.lock);
+
+		auto found = mine.deltas.find(key<_tindex>::encode(index));
+		if(found == mine.deltas.end()) mine.deltas.emplace(key<_tindex>::encode(index), value);
+		else found->second = _func(found->second, value);
+
+		// The clock is only read every few deltas
+		if(mine.deltas.size() < _capacity) {
+			if(++mine.applied % _period != 0) return;
+			if(std::chrono::steady_clock::now() - mine.merged < _interval) return;
+		}
+	}
+
+	// A threshold is reached, merge the buffer
+	std::vector<operation> batch;
+
+	std::lock_guard<rw_lock> guard(_lock);
+	std::lock_guard<std::mutex> local(mine.lock);
+
+	_drain(mine, batch);
+	_tree.batch(batch.begin(), batch.end());
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void buffered_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	buffer& mine = _local();
+	std::vector<operation> batch;
+
+	std::lock_guard<rw_lock> guard(_lock);
+	std::lock_guard<std::mutex> local(mine.lock);
+
+	_drain(mine, batch);
+	batch.push_back(operation{operation::erase, index, _tvalue()});
+	_tree.batch(batch.begin(), batch.end());
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void buffered_tree<_tvalue, _tindex, _functor>::flush() {
+	std::lock_guard<rw_lock> guard(_lock);
+	_flush();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue buffered_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end, level consistency) const {
+	if(consistency == flushed) {
+		std::lock_guard<rw_lock> guard(_lock);
+		_flush();
+		return _tree.query(start, end);
+	}
+
+	shared_guard<rw_lock> guard(_lock);
+	return _tree.query(start, end);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue buffered_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range, level consistency) const {
+	return query(range.first, range.second, consistency);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue buffered_tree<_tvalue, _tindex, _functor>::at(const _tindex& index, level consistency) const {
+	if(consistency == flushed) {
+		std::lock_guard<rw_lock> guard(_lock);
+		_flush();
+		return _tree[index];
+	}
+
+	shared_guard<rw_lock> guard(_lock);
+	return _tree[index];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue buffered_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	return at(index, merged);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void buffered_tree<_tvalue, _tindex, _functor>::clear() {
+	std::lock_guard<rw_lock> guard(_lock);
+	std::lock_guard<std::mutex> registry(_registry);
+
+	for(const std::shared_ptr<buffer>& cur : _buffers) {
+		std::lock_guard<std::mutex> local(cur->lock);
+		cur->deltas.clear();
+	}
+
+	_tree.clear();
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename buffered_tree<_tvalue, _tindex, _functor>::buffer& buffered_tree<_tvalue, _tindex, _functor>::_local() {
+	// The pointer is valid as long as the reference, which is the lifetime of the tree
+	using _tref = std::pair<std::weak_ptr<buffer>, buffer*>;
+	thread_local std::shared_ptr<void> token = std::make_shared<char>();
+	thread_local std::unordered_map<std::size_t, _tref> owned;
+
+	auto found = owned.find(_id);
+	if(found != owned.end()) return *found->second.second;
+
+	// The references to the buffers of destroyed trees are forgotten before adding one
+	for(auto it = owned.begin(); it != owned.end();) {
+		if(it->second.first.expired()) it = owned.erase(it);
+		else ++it;
+	}
+
+	// Not with make_shared, which would keep the memory of the buffer as long as a reference
+	std::shared_ptr<buffer> mine(new buffer());
+	mine->merged = std::chrono::steady_clock::now();
+	mine->owner = token;
+
+	{
+		std::lock_guard<std::mutex> registry(_registry);
+		_prune();
+		_buffers.push_back(mine);
+	}
+
+	owned.emplace(_id, _tref(mine, mine.get()));
+	return *mine;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void buffered_tree<_tvalue, _tindex, _functor>::_drain(buffer& cur, std::vector<operation>& batch) {
+	for(const std::pair<const _tkey, _tvalue>& delta : cur.deltas)
+		batch.push_back(operation{operation::apply, key<_tindex>::decode(delta.first), delta.second});
+
+	cur.deltas.clear();
+	cur.merged = std::chrono::steady_clock::now();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void buffered_tree<_tvalue, _tindex, _functor>::_flush() const {
+	std::vector<operation> batch;
+	std::lock_guard<std::mutex> registry(_registry);
+
+	for(const std::shared_ptr<buffer>& cur : _buffers) {
+		std::lock_guard<std::mutex> local(cur->lock);
+		_drain(*cur, batch);
+	}
+
+	_tree.batch(batch.begin(), batch.end());
+	_prune();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void buffered_tree<_tvalue, _tindex, _functor>::_prune() const {
+	// Nothing but the tree reaches the buffer of a finished thread anymore, which thus stays empty once seen so
+	auto last = std::remove_if(_buffers.begin(), _buffers.end(), [](const std::shared_ptr<buffer>& cur) {
+		if(!cur->owner.expired()) return false;
+
+		std::lock_guard<std::mutex> local(cur->lock);
+		return cur->deltas.empty();
+	});
+
+	_buffers.erase(last, _buffers.end());
+}
+
+}
+
+#endif
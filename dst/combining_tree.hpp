@@ -0,0 +1,274 @@
+/**
+ * @file combining_tree.hpp
+ * @brief Implementation of the flat-combining wrapper of the dynamic segment tree for contended writers.
+ */
+
+#ifndef DST_COMBINING_TREE_HPP_
+#define DST_COMBINING_TREE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rw_lock.hpp"
+#include "tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The combining tree, a thread-safe wrapper of tree where one writer performs the updates of all the others.
+ *
+ * A writer does not lock the tree itself. It publishes its operation in one of 64 slots and waits for it to be done. Any
+ * waiting writer that finds the combiner lock free becomes the combiner, collects every pending operation, and performs
+ * them as one batch of tree, under the exclusive side of a rw_lock. Under heavy write traffic on a hot region, the lock
+ * thus changes hands once per batch instead of once per operation, and the ancestors shared by the batch are recomputed
+ * once. Queries take the rw_lock as readers.
+ *
+ * The operations of a thread are performed in the order it issued them, those of different threads in any order. The
+ * functor must not throw, since the waiting writers would never be released.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class combining_tree {
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	combining_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree by deleting all the nodes.
+	 */
+	void clear();
+
+private:
+	/**
+	 * @brief The operations performed by the tree.
+	 */
+	using operation = typename tree<_tvalue, _tindex, _functor>::operation;
+
+	/**
+	 * @brief The amount of slots.
+	 */
+	static constexpr std::size_t _slots = 64;
+
+	/**
+	 * @brief The states of a slot.
+	 */
+	enum state : unsigned { _free, _claimed, _pending, _done };
+
+	/**
+	 * @brief A slot holding the operation of a waiting writer, padded away from the next one.
+	 */
+	struct slot {
+		std::atomic<unsigned> status;
+		operation request;
+		char padding[64];
+	};
+
+	/**
+	 * @brief The guarded tree.
+	 */
+	tree<_tvalue, _tindex, _functor> _tree;
+
+	/**
+	 * @brief The lock guarding the tree, taken exclusively by the combiner.
+	 */
+	mutable rw_lock _lock;
+
+	/**
+	 * @brief The lock electing the combiner.
+	 */
+	std::mutex _combiner;
+
+	/**
+	 * @brief The slots of the writers.
+	 */
+	slot _requests[_slots];
+
+	/**
+	 * @brief The operations collected by the combiner, kept to reuse their memory.
+	 */
+	std::vector<operation> _batch;
+
+	/**
+	 * @brief The slots served by the combiner, kept to reuse their memory.
+	 */
+	std::vector<slot*> _served;
+
+	/**
+	 * @brief Internal function to publish an operation and wait for it to be performed, combining if possible.
+	 * @param request The operation.
+	 */
+	void _submit(const operation& request);
+
+	/**
+	 * @brief Internal function to perform every pending operation as a batch, run by the combiner.
+	 */
+	void _combine();
+
+	/**
+	 * @brief Internal function to give the preferred slot of the calling thread, assigned in turn on its first call.
+	 */
+	static std::size_t _slot() {
+		static std::atomic<std::size_t> next(0);
+		thread_local std::size_t slot = next.fetch_add(1, std::memory_order_relaxed) % _slots;
+		return slot;
+	}
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+combining_tree<_tvalue, _tindex, _functor>::combining_tree() {
+	for(slot& cur : _requests) cur.status.store(_free, std::memory_order_relaxed);
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void combining_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	_submit(operation{operation::insert, index, value});
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void combining_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	_submit(operation{operation::apply, index, value});
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void combining_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	_submit(operation{operation::erase, index, _tvalue()});
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue combining_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	shared_guard<rw_lock> guard(_lock);
+	return _tree.query(start, end);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue combining_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	shared_guard<rw_lock> guard(_lock);
+	return _tree.query(range);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue combining_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	shared_guard<rw_lock> guard(_lock);
+	return _tree[index];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void combining_tree<_tvalue, _tindex, _functor>::clear() {
+	std::lock_guard<rw_lock> guard(_lock);
+	_tree.clear();
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void combining_tree<_tvalue, _tindex, _functor>::_submit(const operation& request) {
+	slot* mine = nullptr;
+
+	// Claim a free slot, from the preferred one on, in case threads share it
+	for(std::size_t position = _slot(); mine == nullptr; position = (position + 1) % _slots) {
+		unsigned expected = _free;
+		if(_requests[position].status.compare_exchange_strong(expected, _claimed, std::memory_order_acquire)) mine = &_requests[position];
+		else std::this_thread::yield();
+	}
+
+	mine->request = request;
+	mine->status.store(_pending, std::memory_order_release);
+
+	while(mine->status.load(std::memory_order_acquire) != _done) {
+		if(_combiner.try_lock()) {
+			_combine();
+			_combiner.unlock();
+		}
+		else std::this_thread::yield();
+	}
+
+	mine->status.store(_free, std::memory_order_release);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void combining_tree<_tvalue, _tindex, _functor>::_combine() {
+	_batch.clear();
+	_served.clear();
+
+	for(slot& cur : _requests) {
+		if(cur.status.load(std::memory_order_acquire) != _pending) continue;
+
+		_batch.push_back(cur.request);
+		_served.push_back(&cur);
+	}
+
+	if(_batch.empty()) return;
+
+	{
+		std::lock_guard<rw_lock> guard(_lock);
+		_tree.batch(_batch.begin(), _batch.end());
+	}
+
+	for(slot* cur : _served) cur->status.store(_done, std::memory_order_release);
+}
+
+}
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * @file concurrent_tree.hpp
+ * @brief Implementation of the thread-safe wrapper of the dynamic segment tree.
+ */
+
+#ifndef DST_CONCURRENT_TREE_HPP_
+#define DST_CONCURRENT_TREE_HPP_
+
+#include <functional>
+#include <mutex>
+#include <utility>
+
+#include "rw_lock.hpp"
+#include "tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The concurrent tree, which is a thread-safe wrapper structure around the dynamic segment tree.
+ *
+ * This class guards a tree with a rw_lock, so that it can be shared between threads. Queries take the lock as readers and
+ * run in parallel through the const methods of tree, while modifications take it exclusively. Every method is safe to call
+ * from any thread, and the functor must not access the tree itself.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class concurrent_tree {
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	concurrent_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree by deleting all the nodes.
+	 */
+	void clear();
+
+private:
+	/**
+	 * @brief The guarded tree.
+	 */
+	tree<_tvalue, _tindex, _functor> _tree;
+
+	/**
+	 * @brief The lock guarding the tree, taken by the const methods as well.
+	 */
+	mutable rw_lock _lock;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+concurrent_tree<_tvalue, _tindex, _functor>::concurrent_tree() {}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void concurrent_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<rw_lock> guard(_lock);
+	_tree.insert(index, value);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void concurrent_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<rw_lock> guard(_lock);
+	_tree.apply(index, value);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void concurrent_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	std::lock_guard<rw_lock> guard(_lock);
+	_tree.erase(index);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue concurrent_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	shared_guard<rw_lock> guard(_lock);
+	return _tree.query(start, end);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue concurrent_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	shared_guard<rw_lock> guard(_lock);
+	return _tree.query(range);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue concurrent_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	shared_guard<rw_lock> guard(_lock);
+	return _tree[index];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void concurrent_tree<_tvalue, _tindex, _functor>::clear() {
+	std::lock_guard<rw_lock> guard(_lock);
+	_tree.clear();
+}
+
+}
+
+#endif
@@ -0,0 +1,465 @@
+/**
+ * @file counter_tree.hpp
+ * @brief Implementation of the concurrent sum tree whose updates of existing indices are lock-free additions.
+ */
+
+#ifndef DST_COUNTER_TREE_HPP_
+#define DST_COUNTER_TREE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bit.hpp"
+#include "epoch.hpp"
+#include "key.hpp"
+
+namespace dst {
+
+/**
+ * @brief The counter tree, a concurrent dynamic segment tree summing integral values.
+ *
+ * This class has the layout of tree aggregated by std::plus, with every value held in a std::atomic. Applying a delta
+ * to an existing index takes no lock: it enters an epoch, finds the path to the leaf, and adds the delta to the nodes of
+ * the path with fetch_add, so that concurrent counters never wait for one another nor for the writers. Changes to the
+ * structure, which are new indices, insertions replacing a value and erasures, are serialized by a mutex and publish
+ * every new node with a single store.
+ *
+ * A parent created above an existing subtree inherits it, as in atomic_tree: the parent only counts the other child and
+ * the subtree keeps counting itself, so that additions still holding the former path are not lost. An erasure marks and
+ * unlinks the leaf, then waits for the epochs in flight before subtracting its value from the ancestors: an addition
+ * seeing the mark takes itself back from the leaf and starts over as a new index, so that erasures are as slow as a
+ * synchronize of epoch. A query running during additions sees each of them at most once, either whole or not at all for
+ * each part of its range. Sums wrap around as in unsigned arithmetic.
+ *
+ * @tparam _tvalue The integral type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ */
+template<typename _tvalue, typename _tindex>
+class counter_tree {
+	static_assert(std::is_integral<_tvalue>::value && !std::is_same<_tvalue, bool>::value, "The value type must be integral");
+
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	counter_tree();
+
+	counter_tree(const counter_tree&) = delete;
+	counter_tree& operator=(const counter_tree&) = delete;
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Add a value to a given index in the tree, without taking any lock if the index exists.
+	 * @param index The index to apply the value on.
+	 * @param value The value to add.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Sum the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The sum of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Sum the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The sum of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree by deleting all the nodes.
+	 */
+	void clear();
+
+	/**
+	 * @brief Destructor for the tree.
+	 */
+	~counter_tree();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The unsigned value type the sums are computed in.
+	 */
+	using _tunsigned = typename std::make_unsigned<_tvalue>::type;
+
+	/**
+	 * @brief The side of a node without an inherited child.
+	 */
+	static constexpr std::size_t _none = 2;
+
+	/**
+	 * @brief The node of the tree. The value of a leaf is its own, the value of a parent sums the leaves under its other
+	 * child than the inherited one.
+	 */
+	class node {
+	private:
+		const std::pair<_tkey, _tkey> _range;
+		std::atomic<_tvalue> _value;
+		std::atomic<node*> _children[2];
+
+		const std::size_t _inherit;
+		std::atomic<bool> _dead;
+
+	public:
+		node(const std::pair<_tkey, _tkey>& range, const _tvalue& value, node* l, node* r, std::size_t inherit)
+			: _range(range), _value(value), _children{{l}, {r}}, _inherit(inherit), _dead(false) {}
+
+		node(const _tkey& index, const _tvalue& value)
+			: node(std::make_pair(index, index), value, nullptr, nullptr, _none) {}
+
+		std::atomic<_tvalue>& value() { return _value; }
+		const std::atomic<_tvalue>& value() const { return _value; }
+		std::pair<_tkey, _tkey> range() const { return _range; }
+
+		std::atomic<node*>& child(std::size_t side) { return _children[side]; }
+		const std::atomic<node*>& child(std::size_t side) const { return _children[side]; }
+
+		std::size_t inherit() const { return _inherit; }
+		std::atomic<bool>& dead() { return _dead; }
+	};
+
+	/**
+	 * @brief The root of the tree.
+	 */
+	std::atomic<node*> _root;
+
+	/**
+	 * @brief The mutex serializing the changes to the structure.
+	 */
+	std::mutex _writer;
+
+	/**
+	 * @brief The epochs of the readers and the additions.
+	 */
+	mutable epoch _epoch;
+
+	/**
+	 * @brief Internal function to add two values with the wrap-around of unsigned arithmetic.
+	 * @param a The first value.
+	 * @param b The second value.
+	 * @return The sum.
+	 */
+	static _tvalue _add(const _tvalue& a, const _tvalue& b) { return _tvalue(_tunsigned(a) + _tunsigned(b)); }
+
+	/**
+	 * @brief Internal function to find the path from the root to the leaf of a key.
+	 * @param index The key to look for.
+	 * @param path The nodes of the path.
+	 * @param sides The side taken below each node of the path.
+	 * @return The length of the path, or 0 if the key is absent.
+	 */
+	std::size_t _find(const _tkey& index, node** path, std::size_t* sides) const;
+
+	/**
+	 * @brief Internal function to add a value to the ancestors of a leaf counting it.
+	 * @param path The ancestors of the leaf.
+	 * @param sides The side taken below each ancestor.
+	 * @param length The number of ancestors.
+	 * @param value The value to add.
+	 */
+	static void _spread(node* const* path, const std::size_t* sides, std::size_t length, const _tvalue& value);
+
+	/**
+	 * @brief Internal function to insert or add a value at a given key, under the writer mutex.
+	 * @param index The key to write.
+	 * @param value The value to write.
+	 * @param combine Whether to add the value to an existing one instead of replacing it.
+	 */
+	void _write(const _tkey& index, const _tvalue& value, bool combine);
+
+	/**
+	 * @brief Internal function to sum the leaves of a subtree.
+	 * @param cur The root of the subtree.
+	 * @return The sum of the subtree.
+	 */
+	static _tvalue _total(const node* cur);
+
+	/**
+	 * @brief Internal function to sum the values of a range of keys.
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @return The sum of the range.
+	 */
+	_tvalue _query(const node* cur, const std::pair<_tkey, _tkey>& segment) const;
+
+	/**
+	 * @brief Internal function to collect every node of a subtree.
+	 * @param cur The root of the subtree.
+	 * @param nodes The collected nodes.
+	 */
+	static void _collect(node* cur, std::vector<node*>& nodes);
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex>
+counter_tree<_tvalue, _tindex>::counter_tree() : _root(nullptr) {}
+
+template<typename _tvalue, typename _tindex>
+counter_tree<_tvalue, _tindex>::~counter_tree() {
+	std::vector<node*> nodes;
+	_collect(_root.load(std::memory_order_relaxed), nodes);
+	for(node* cur : nodes) delete cur;
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex>
+void counter_tree<_tvalue, _tindex>::insert(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<std::mutex> guard(_writer);
+	_write(key<_tindex>::encode(index), value, false);
+}
+
+template<typename _tvalue, typename _tindex>
+void counter_tree<_tvalue, _tindex>::apply(const _tindex& index, const _tvalue& value) {
+	_tkey target = key<_tindex>::encode(index);
+
+	{
+		node* path[(sizeof(_tkey) << 3) + 1];
+		std::size_t sides[(sizeof(_tkey) << 3) + 1];
+
+		epoch::guard guard(_epoch);
+		std::size_t length = _find(target, path, sides);
+
+		if(length > 0) {
+			// The leaf first, so that an erasure waiting for this epoch subtracts the addition from the ancestors
+			node* leaf = path[length - 1];
+			leaf->value().fetch_add(value, std::memory_order_relaxed);
+
+			if(!leaf->dead().load(std::memory_order_seq_cst)) {
+				_spread(path, sides, length - 1, value);
+				return;
+			}
+
+			leaf->value().fetch_sub(value, std::memory_order_relaxed);
+		}
+	}
+
+	// A new or erased index, which changes the structure
+	std::lock_guard<std::mutex> guard(_writer);
+	_write(target, value, true);
+}
+
+template<typename _tvalue, typename _tindex>
+void counter_tree<_tvalue, _tindex>::erase(const _tindex& index) {
+	node* path[(sizeof(_tkey) << 3) + 1];
+	std::size_t sides[(sizeof(_tkey) << 3) + 1];
+
+	std::lock_guard<std::mutex> guard(_writer);
+	std::size_t length = _find(key<_tindex>::encode(index), path, sides);
+	if(length == 0) return;
+
+	node* leaf = path[length - 1];
+	leaf->dead().store(true, std::memory_order_seq_cst);
+
+	// The parent is left with one child, which replaces it
+	std::size_t kept = length < 2 ? 0 : length - 2;
+	node* other = nullptr;
+	if(length > 1) other = path[length - 2]->child(1 - sides[length - 2]).load(std::memory_order_relaxed);
+
+	if(kept == 0) _root.store(other, std::memory_order_release);
+	else path[kept - 1]->child(sides[kept - 1]).store(other, std::memory_order_release);
+
+	// Every addition to the leaf has then either reached the ancestors or been taken back
+	_epoch.synchronize();
+	_tvalue value = leaf->value().load(std::memory_order_relaxed);
+	_spread(path, sides, kept, _tvalue(_tunsigned(0) - _tunsigned(value)));
+
+	delete leaf;
+	if(length > 1) delete path[length - 2];
+}
+
+template<typename _tvalue, typename _tindex>
+_tvalue counter_tree<_tvalue, _tindex>::query(const _tindex& start, const _tindex& end) const {
+	epoch::guard guard(_epoch);
+	return _query(_root.load(std::memory_order_acquire), std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end)));
+}
+
+template<typename _tvalue, typename _tindex>
+_tvalue counter_tree<_tvalue, _tindex>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex>
+_tvalue counter_tree<_tvalue, _tindex>::operator[](const _tindex& index) const {
+	node* path[(sizeof(_tkey) << 3) + 1];
+	std::size_t sides[(sizeof(_tkey) << 3) + 1];
+
+	epoch::guard guard(_epoch);
+	std::size_t length = _find(key<_tindex>::encode(index), path, sides);
+	return length == 0 ? _tvalue() : path[length - 1]->value().load(std::memory_order_relaxed);
+}
+
+template<typename _tvalue, typename _tindex>
+void counter_tree<_tvalue, _tindex>::clear() {
+	std::lock_guard<std::mutex> guard(_writer);
+
+	std::vector<node*> nodes;
+	_collect(_root.exchange(nullptr, std::memory_order_acq_rel), nodes);
+
+	_epoch.synchronize();
+	for(node* cur : nodes) delete cur;
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex>
+std::size_t counter_tree<_tvalue, _tindex>::_find(const _tkey& index, node** path, std::size_t* sides) const {
+	std::size_t length = 0;
+
+	for(node* cur = _root.load(std::memory_order_acquire); cur != nullptr;) {
+		auto range = cur->range();
+		if(index < range.first || range.second < index) return 0;
+
+		path[length] = cur;
+		if(range.first == range.second) return length + 1;
+
+		auto mid = range.first + (range.second - range.first) / 2;
+		sides[length] = index <= mid ? 0 : 1;
+		cur = cur->child(sides[length++]).load(std::memory_order_acquire);
+	}
+
+	return 0;
+}
+
+template<typename _tvalue, typename _tindex>
+void counter_tree<_tvalue, _tindex>::_spread(node* const* path, const std::size_t* sides, std::size_t length,
+	const _tvalue& value) {
+	for(std::size_t i = 0; i < length; ++i)
+		if(sides[i] != path[i]->inherit()) path[i]->value().fetch_add(value, std::memory_order_relaxed);
+}
+
+template<typename _tvalue, typename _tindex>
+void counter_tree<_tvalue, _tindex>::_write(const _tkey& index, const _tvalue& value, bool combine) {
+	node* path[(sizeof(_tkey) << 3) + 1];
+	std::size_t sides[(sizeof(_tkey) << 3) + 1];
+	std::size_t length = 0;
+
+	node* cur = _root.load(std::memory_order_relaxed);
+
+	while(cur != nullptr) {
+		auto range = cur->range();
+		if(index < range.first || range.second < index) break;
+
+		if(range.first == range.second) {
+			_tvalue delta = value;
+
+			// Replacing a value adds the difference, racing additions landing on either side of the exchange
+			if(combine) cur->value().fetch_add(value, std::memory_order_seq_cst);
+			else delta = _add(value, _tvalue(_tunsigned(0) - _tunsigned(cur->value().exchange(value, std::memory_order_seq_cst))));
+
+			_spread(path, sides, length, delta);
+			return;
+		}
+
+		auto mid = range.first + (range.second - range.first) / 2;
+		path[length] = cur;
+		sides[length] = index <= mid ? 0 : 1;
+		cur = cur->child(sides[length++]).load(std::memory_order_relaxed);
+	}
+
+	node* created = new node(index, value);
+
+	// Outside of the subtree, which goes under a new parent inheriting it
+	if(cur != nullptr) {
+		auto range = cur->range();
+		_tkey mask = bit::block(range.first, index);
+		std::pair<_tkey, _tkey> parent = std::make_pair(_tkey(index & ~mask), _tkey(index | mask));
+
+		if(index < range.first) created = new node(parent, value, created, cur, 1);
+		else created = new node(parent, value, cur, created, 0);
+	}
+
+	if(length == 0) _root.store(created, std::memory_order_release);
+	else path[length - 1]->child(sides[length - 1]).store(created, std::memory_order_release);
+
+	_spread(path, sides, length, value);
+}
+
+template<typename _tvalue, typename _tindex>
+_tvalue counter_tree<_tvalue, _tindex>::_total(const node* cur) {
+	_tvalue result = cur->value().load(std::memory_order_relaxed);
+
+	for(; cur->inherit() != _none;) {
+		cur = cur->child(cur->inherit()).load(std::memory_order_acquire);
+		result = _add(result, cur->value().load(std::memory_order_relaxed));
+	}
+
+	return result;
+}
+
+template<typename _tvalue, typename _tindex>
+_tvalue counter_tree<_tvalue, _tindex>::_query(const node* cur, const std::pair<_tkey, _tkey>& segment) const {
+	if(cur == nullptr) return _tvalue();
+
+	auto range = cur->range();
+
+	if(segment.first <= range.first && range.second <= segment.second)
+		return _total(cur);
+
+	if(segment.second < range.first || range.second < segment.first || range.first == range.second)
+		return _tvalue();
+
+	auto mid = range.first + (range.second - range.first) / 2;
+	const node* left = cur->child(0).load(std::memory_order_acquire);
+	const node* right = cur->child(1).load(std::memory_order_acquire);
+
+	if(segment.first <= mid && mid < segment.second)
+		return _add(_query(left, segment), _query(right, segment));
+
+	if(segment.second <= mid)
+		return _query(left, segment);
+
+	return _query(right, segment);
+}
+
+template<typename _tvalue, typename _tindex>
+void counter_tree<_tvalue, _tindex>::_collect(node* cur, std::vector<node*>& nodes) {
+	if(cur == nullptr) return;
+
+	nodes.push_back(cur);
+	_collect(cur->child(0).load(std::memory_order_relaxed), nodes);
+	_collect(cur->child(1).load(std::memory_order_relaxed), nodes);
+}
+
+}
+
+#endif
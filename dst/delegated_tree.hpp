@@ -0,0 +1,345 @@
+/**
+ * @file delegated_tree.hpp
+ * @brief Implementation of the dynamic segment tree owned by a single thread serving the requests of the others.
+ */
+
+#ifndef DST_DELEGATED_TREE_HPP_
+#define DST_DELEGATED_TREE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ring.hpp"
+#include "tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The delegated tree, a tree owned by a dedicated thread to which the other threads send their requests.
+ *
+ * Only the owner thread ever touches the tree, which thus stays in the cache of its core and needs no synchronization.
+ * Other threads push their requests to a lock-free ring. Writes return at once, and queries return a future or run a
+ * callback on the owner thread with the result. The owner drains the ring, and performs each run of consecutive writes as
+ * one batch of tree before answering the query that follows it, so the requests of a thread take effect in the order it
+ * sent them. When the ring stays empty the owner goes to sleep and is woken by the next request.
+ *
+ * If the functor throws while the owner performs a batch of writes, or answers a query with a callback, the exception is
+ * kept and set on the future of the next query instead of ending the owner thread. The writes of that batch may then be
+ * partly applied.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class delegated_tree {
+public:
+	/**
+	 * @brief Constructor for the tree, starting the owner thread.
+	 * @param capacity The amount of requests the ring holds before the senders wait.
+	 */
+	explicit delegated_tree(std::size_t capacity = 4096);
+
+	delegated_tree(const delegated_tree&) = delete;
+	delegated_tree& operator=(const delegated_tree&) = delete;
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The future aggregate value of the range, or of the exception of an earlier failed write, see the class.
+	 */
+	std::future<_tvalue> query(const _tindex& start, const _tindex& end);
+
+	/**
+	 * @brief Aggregate the values in the given range, handing the result to a callback run by the owner thread.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @param callback The function receiving the aggregate value of the range, which must neither throw nor access the tree.
+	 */
+	void query(const _tindex& start, const _tindex& end, std::function<void(const _tvalue&)> callback);
+
+	/**
+	 * @brief Destructor for the tree, which serves the pending requests before stopping the owner thread.
+	 */
+	~delegated_tree();
+
+private:
+	/**
+	 * @brief The operations performed by the tree.
+	 */
+	using operation = typename tree<_tvalue, _tindex, _functor>::operation;
+
+	/**
+	 * @brief A request to the owner thread, either a write or a query.
+	 */
+	struct request {
+		bool write;
+		operation change;
+		std::pair<_tindex, _tindex> range;
+		std::shared_ptr<std::promise<_tvalue>> result;
+		std::function<void(const _tvalue&)> callback;
+	};
+
+	/**
+	 * @brief The amount of empty polls before the owner goes to sleep.
+	 */
+	static constexpr std::size_t _patience = 256;
+
+	/**
+	 * @brief The tree, only accessed by the owner thread.
+	 */
+	tree<_tvalue, _tindex, _functor> _tree;
+
+	/**
+	 * @brief The requests sent to the owner.
+	 */
+	ring<request> _requests;
+
+	/**
+	 * @brief Whether the tree is being destroyed.
+	 */
+	std::atomic<bool> _stop;
+
+	/**
+	 * @brief Whether the owner is asleep or about to be, so that the senders wake it.
+	 */
+	std::atomic<bool> _asleep;
+
+	/**
+	 * @brief The mutex and signal waking the owner.
+	 */
+	std::mutex _mutex;
+	std::condition_variable _wake;
+
+	/**
+	 * @brief The exception thrown by the last failed write, until a query hands it over, only accessed by the owner thread.
+	 */
+	std::exception_ptr _error;
+
+	/**
+	 * @brief The owner thread, started last.
+	 */
+	std::thread _owner;
+
+	/**
+	 * @brief Internal function to send a request, waiting for room in the ring.
+	 * @param cur The request.
+	 */
+	void _send(request& cur);
+
+	/**
+	 * @brief Internal function run by the owner thread.
+	 */
+	void _serve();
+
+	/**
+	 * @brief Internal function to perform the pending writes as one batch on the owner thread, keeping any exception.
+	 * @param writes The pending writes, cleared.
+	 */
+	void _flush(std::vector<operation>& writes);
+
+	/**
+	 * @brief Internal function to answer a query on the owner thread.
+	 * @param cur The query.
+	 */
+	void _answer(request& cur);
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+delegated_tree<_tvalue, _tindex, _functor>::delegated_tree(std::size_t capacity)
+	: _requests(capacity), _stop(false), _asleep(false), _owner([this] { _serve(); }) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+delegated_tree<_tvalue, _tindex, _functor>::~delegated_tree() {
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		_stop.store(true);
+	}
+
+	_wake.notify_one();
+	_owner.join();
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void delegated_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	request cur{true, operation{operation::insert, index, value}, std::make_pair(index, index), nullptr, nullptr};
+	_send(cur);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void delegated_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	request cur{true, operation{operation::apply, index, value}, std::make_pair(index, index), nullptr, nullptr};
+	_send(cur);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void delegated_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	request cur{true, operation{operation::erase, index, _tvalue()}, std::make_pair(index, index), nullptr, nullptr};
+	_send(cur);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::future<_tvalue> delegated_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) {
+	auto result = std::make_shared<std::promise<_tvalue>>();
+	std::future<_tvalue> answer = result->get_future();
+
+	request cur{false, operation{operation::insert, start, _tvalue()}, std::make_pair(start, end), result, nullptr};
+	_send(cur);
+	return answer;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void delegated_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end,
+	std::function<void(const _tvalue&)> callback) {
+
+	request cur{false, operation{operation::insert, start, _tvalue()}, std::make_pair(start, end), nullptr, std::move(callback)};
+	_send(cur);
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void delegated_tree<_tvalue, _tindex, _functor>::_send(request& cur) {
+	while(!_requests.push(cur)) std::this_thread::yield();
+
+	// Pairs with the fence of the owner going to sleep, so that one of the two sees the other
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if(_asleep.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> guard(_mutex);
+		_wake.notify_one();
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void delegated_tree<_tvalue, _tindex, _functor>::_serve() {
+	std::vector<operation> writes;
+	request cur;
+	std::size_t idle = 0;
+
+	while(true) {
+		// Drain the ring, gathering the consecutive writes into one batch
+		while(_requests.pop(cur)) {
+			idle = 0;
+
+			if(cur.write) {
+				writes.push_back(cur.change);
+				continue;
+			}
+
+			_flush(writes);
+			_answer(cur);
+		}
+
+		_flush(writes);
+
+		if(++idle < _patience) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		// Announce the sleep before the last look, so that a sender either is seen or sees it
+		std::unique_lock<std::mutex> guard(_mutex);
+		_asleep.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if(_requests.pop(cur)) {
+			_asleep.store(false, std::memory_order_relaxed);
+			guard.unlock();
+
+			if(cur.write) writes.push_back(cur.change);
+			else _answer(cur);
+			continue;
+		}
+
+		if(_stop.load()) return;
+
+		_wake.wait_for(guard, std::chrono::milliseconds(10));
+		_asleep.store(false, std::memory_order_relaxed);
+		idle = 0;
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void delegated_tree<_tvalue, _tindex, _functor>::_flush(std::vector<operation>& writes) {
+	try {
+		_tree.batch(writes.begin(), writes.end());
+	}
+	catch(...) {
+		if(!_error) _error = std::current_exception();
+	}
+
+	writes.clear();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void delegated_tree<_tvalue, _tindex, _functor>::_answer(request& cur) {
+	if(cur.callback) {
+		try {
+			cur.callback(_tree.query(cur.range));
+		}
+		catch(...) {
+			if(!_error) _error = std::current_exception();
+		}
+
+		return;
+	}
+
+	if(_error) {
+		cur.result->set_exception(_error);
+		_error = nullptr;
+		return;
+	}
+
+	try {
+		cur.result->set_value(_tree.query(cur.range));
+	}
+	catch(...) {
+		cur.result->set_exception(std::current_exception());
+	}
+}
+
+}
+
+#endif
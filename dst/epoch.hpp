@@ -0,0 +1,135 @@
+/**
+ * @file epoch.hpp
+ * @brief Implementation of the epoch-based reclamation used by the lock-free readers.
+ */
+
+#ifndef DST_EPOCH_HPP_
+#define DST_EPOCH_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+namespace dst {
+
+/**
+ * @brief The epochs of readers, telling writers when the memory they unlinked can no longer be reached.
+ *
+ * A reader enters the current phase, which is 0 or 1, by counting itself on it for the time of its traversal. A writer that
+ * unlinked some nodes calls synchronize, which flips the phase twice and each time waits for the readers counted on the
+ * phase left to drain. Every reader that could have seen the nodes has then left, while the readers entering meanwhile
+ * only see what the writer published. Reading is two uncontended atomic operations, the counters of the threads being
+ * spread over 64 cache lines as in rw_lock. Waiting for readers is slow, so writers should batch the nodes they retire
+ * between calls to synchronize.
+ */
+class epoch {
+public:
+	/**
+	 * @brief Scoped presence of a reader in the current phase.
+	 */
+	class guard {
+	public:
+		explicit guard(epoch& owner) : _owner(owner), _slot(_owner._slot()), _phase(_owner._enter(_slot)) {}
+		~guard() { _owner._leave(_slot, _phase); }
+
+		guard(const guard&) = delete;
+		guard& operator=(const guard&) = delete;
+
+	private:
+		epoch& _owner;
+		std::size_t _slot;
+		std::size_t _phase;
+	};
+
+	/**
+	 * @brief Constructor for the epochs.
+	 */
+	epoch() : _phase(0) {
+		for(counter& cur : _readers) {
+			cur.value[0].store(0, std::memory_order_relaxed);
+			cur.value[1].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	epoch(const epoch&) = delete;
+	epoch& operator=(const epoch&) = delete;
+
+	/**
+	 * @brief Wait until every reader that entered before the call has left.
+	 */
+	void synchronize() {
+		std::lock_guard<std::mutex> guard(_mutex);
+
+		// A reader may have read the phase before the first flip and counted itself after it, the second flip catches it
+		for(int round = 0; round < 2; ++round) {
+			std::size_t old = _phase.load(std::memory_order_relaxed);
+			_phase.store(old ^ 1, std::memory_order_seq_cst);
+
+			for(counter& cur : _readers)
+				while(cur.value[old].load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+		}
+	}
+
+private:
+	/**
+	 * @brief The amount of reader counters.
+	 */
+	static constexpr std::size_t _slots = 64;
+
+	/**
+	 * @brief The reader counters of both phases, padded to a cache line.
+	 */
+	struct counter {
+		std::atomic<std::size_t> value[2];
+		char padding[64 - 2 * sizeof(std::atomic<std::size_t>)];
+	};
+
+	/**
+	 * @brief The reader counters.
+	 */
+	counter _readers[_slots];
+
+	/**
+	 * @brief The current phase.
+	 */
+	std::atomic<std::size_t> _phase;
+
+	/**
+	 * @brief The mutex serializing the writers waiting for the readers.
+	 */
+	std::mutex _mutex;
+
+	/**
+	 * @brief Internal function to count a reader on the current phase.
+	 * @param slot The counter of the reader.
+	 * @return The phase entered.
+	 */
+	std::size_t _enter(std::size_t slot) {
+		std::size_t phase = _phase.load(std::memory_order_seq_cst);
+		_readers[slot].value[phase].fetch_add(1, std::memory_order_seq_cst);
+		return phase;
+	}
+
+	/**
+	 * @brief Internal function to uncount a reader.
+	 * @param slot The counter of the reader.
+	 * @param phase The phase it entered.
+	 */
+	void _leave(std::size_t slot, std::size_t phase) {
+		_readers[slot].value[phase].fetch_sub(1, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Internal function to give the counter of the calling thread, assigned in turn on its first call.
+	 */
+	static std::size_t _slot() {
+		static std::atomic<std::size_t> next(0);
+		thread_local std::size_t slot = next.fetch_add(1, std::memory_order_relaxed) % _slots;
+		return slot;
+	}
+};
+
+}
+
+#endif
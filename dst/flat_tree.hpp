@@ -0,0 +1,660 @@
+/**
+ * @file flat_tree.hpp
+ * @brief Implementation of the flat segment tree used for small universes of indices.
+ */
+
+#ifndef DST_FLAT_TREE_HPP_
+#define DST_FLAT_TREE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "key.hpp"
+#include "thread_pool.hpp"
+
+namespace dst {
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+class tree;
+
+/**
+ * @brief The flat segment tree over a universe of indices known at compile time.
+ *
+ * This class offers the interface of tree as an implicit segment tree over an array, with one bit per node recording whether
+ * its subtree holds an index. It is what tree resolves to for the index types of universe, namely integers of at most 16 bits
+ * and bounded universes. The array spans the universe rounded up to a power of 2, which makes every operation a short loop
+ * without any pointer chasing, and nodes aggregate only the children holding an index, so that the functor never sees the
+ * values of missing indices, as in tree.
+ *
+ * Since the array is as large as the universe, the indices are first kept in a pointer tree, which costs memory in proportion
+ * to their amount. The array replaces it once it is no larger than the pointer tree would be, and is kept from then on until
+ * the tree is cleared.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with a non-zero universe.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class flat_tree {
+	static_assert(universe<_tindex>::value > 0, "The index type must have a small universe");
+
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	flat_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree. An index outside of the universe, which a bounded index can hold,
+	 * is ignored.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree. An index outside of the universe is ignored.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree. An index outside of the universe is ignored.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Aggregate the values in the given range, telling whether any index of the range exists in the tree.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @param result The aggregate value of the range, left unchanged if there is none.
+	 * @return Whether an index of the range exists in the tree.
+	 */
+	bool query(const _tindex& start, const _tindex& end, _tvalue& result) const;
+
+	/**
+	 * @brief Aggregate the values in the given range, serially since the tree is small.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @param pool The pool of tree, unused.
+	 * @param grain The grain of tree, unused.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end, thread_pool& pool, std::size_t grain = 4) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Find the first index at which the aggregate of the values up to it satisfies a monotone predicate.
+	 * @param predicate The predicate on the aggregate values.
+	 * @param index The index found, left unchanged if there is none.
+	 * @return Whether an index satisfies the predicate.
+	 */
+	template<class _predicate>
+	bool search(_predicate predicate, _tindex& index) const;
+
+	/**
+	 * @brief The orders in which parallel_for_each visits the indices, see tree.
+	 */
+	enum order { unordered, ordered };
+
+	/**
+	 * @brief Call a function on every index in the given range, with its value, in the order of the indices.
+	 * @param start The start of the range, inclusive.
+	 * @param end The end of the range, inclusive.
+	 * @param function The function, called with the index and the value.
+	 */
+	template<class _function>
+	void for_each(const _tindex& start, const _tindex& end, _function function) const;
+
+	/**
+	 * @brief Call a function on every index in the given range, serially and in order since the array is small.
+	 * @param start The start of the range, inclusive.
+	 * @param end The end of the range, inclusive.
+	 * @param function The function, called with the index and the value.
+	 * @param pool The pool of tree, unused.
+	 * @param visit The order of tree, unused.
+	 */
+	template<class _function>
+	void parallel_for_each(const _tindex& start, const _tindex& end, _function function, thread_pool& pool,
+		order visit = unordered) const;
+
+	/**
+	 * @brief An operation of a batch, see batch.
+	 */
+	struct operation {
+		enum kind { insert, apply, erase };
+
+		kind type;
+		_tindex index;
+		_tvalue value;
+	};
+
+	/**
+	 * @brief Perform a batch of operations at once, recomputing every ancestor of the leaves they touch once. Operations on
+	 * indices outside of the universe are ignored.
+	 * @param first The first operation of the batch.
+	 * @param last The end of the batch.
+	 */
+	template<class _iterator>
+	void batch(_iterator first, _iterator last);
+
+	/**
+	 * @brief Replace the content of the tree by the given entries, setting the leaves then every node bottom-up. Entries
+	 * outside of the universe are ignored.
+	 * @param first The first entry, a std::pair of an index and its value.
+	 * @param last The end of the entries.
+	 */
+	template<class _iterator>
+	void build(_iterator first, _iterator last);
+
+	/**
+	 * @brief Replace the content of the tree by the given entries, serially since the array is small.
+	 * @param first The first entry, a std::pair of an index and its value.
+	 * @param last The end of the entries.
+	 * @param pool The pool of tree, unused.
+	 */
+	template<class _iterator>
+	void build(_iterator first, _iterator last, thread_pool& pool);
+
+	/**
+	 * @brief Clear the tree, releasing the array and going back to the pointer tree.
+	 */
+	void clear();
+
+	/**
+	 * @brief The finger of tree, which has no path to remember here and forwards every operation to the tree.
+	 */
+	class finger {
+	public:
+		finger(flat_tree& owner) : _tree(&owner) {}
+
+		void insert(const _tindex& index, const _tvalue& value) { _tree->insert(index, value); }
+		void apply(const _tindex& index, const _tvalue& value) { _tree->apply(index, value); }
+		_tvalue query(const _tindex& start, const _tindex& end) { return _tree->query(start, end); }
+		_tvalue query(const std::pair<_tindex, _tindex>& range) { return _tree->query(range); }
+		_tvalue operator[](const _tindex& index) { return (*_tree)[index]; }
+
+	private:
+		flat_tree* _tree;
+	};
+
+private:
+	/**
+	 * @brief Internal function to round a size up to a power of 2.
+	 */
+	static constexpr std::size_t _round(std::size_t size, std::size_t power = 1) {
+		return (power >= size) ? power : _round(size, power << 1);
+	}
+
+	/**
+	 * @brief The amount of leaves, the universe rounded up to a power of 2.
+	 */
+	static constexpr std::size_t _capacity = _round(universe<_tindex>::value);
+
+	/**
+	 * @brief The layout of a node of the pointer tree, one key, a value and three links, padding included.
+	 */
+	struct _layout {
+		typename key<_tindex>::type key;
+		_tvalue value;
+		void* links[3];
+	};
+
+	/**
+	 * @brief The size of a node of the pointer tree, about two of which are needed per index.
+	 */
+	static constexpr std::size_t _node = sizeof(_layout);
+
+	/**
+	 * @brief The amount of indices from which the array is no larger than the pointer tree.
+	 */
+	static constexpr std::size_t _dense = (2 * _capacity * sizeof(_tvalue) + _capacity / 4) / (2 * _node) + 1;
+
+	/**
+	 * @brief The pointer tree holding the indices until there are enough of them for the array.
+	 */
+	tree<_tvalue, _tindex, _functor, false> _sparse;
+
+	/**
+	 * @brief The amount of indices in the pointer tree.
+	 */
+	std::size_t _size;
+
+	/**
+	 * @brief The implicit segment tree, with the root at 1 and the leaves from _capacity on, empty while sparse.
+	 */
+	std::vector<_tvalue> _values;
+
+	/**
+	 * @brief Whether the subtree of every node holds an index, packed in words and indexed as the array.
+	 */
+	std::vector<std::uint64_t> _filled;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to tell whether a node holds an index in its subtree.
+	 * @param position The position of the node in the array.
+	 */
+	bool _has(std::size_t position) const;
+
+	/**
+	 * @brief Internal function to tell whether the pointer tree holds an index.
+	 * @param index The index to look for.
+	 */
+	bool _contains(const _tindex& index) const;
+
+	/**
+	 * @brief Internal function to move the indices from the pointer tree to the array once there are enough of them.
+	 */
+	void _densify();
+
+	/**
+	 * @brief Internal function to allocate the array.
+	 */
+	void _allocate();
+
+	/**
+	 * @brief Internal function to set a leaf, present or not.
+	 * @param position The position of the leaf.
+	 * @param value The new value of the leaf.
+	 * @param present Whether the index is present.
+	 */
+	void _set(std::size_t position, const _tvalue& value, bool present);
+
+	/**
+	 * @brief Internal function to recompute a node from the children holding an index.
+	 * @param position The position of the node in the array.
+	 */
+	void _pull(std::size_t position);
+
+	/**
+	 * @brief Internal function to set a leaf and recompute its ancestors.
+	 * @param position The position of the leaf.
+	 * @param value The new value of the leaf.
+	 * @param present Whether the index is present.
+	 */
+	void _update(std::size_t position, const _tvalue& value, bool present);
+
+	/**
+	 * @brief Internal function to query the aggregate value of a range of positions, keeping the key order.
+	 * @param start The first position of the range.
+	 * @param end The last position of the range.
+	 * @param result The aggregate value of the range, left unchanged if there is none.
+	 * @return Whether a position of the range holds an index.
+	 */
+	bool _query(std::size_t start, std::size_t end, _tvalue& result) const;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+flat_tree<_tvalue, _tindex, _functor>::flat_tree() : _size(0) {}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	std::size_t position = key<_tindex>::encode(index);
+	if(position >= universe<_tindex>::value) return;
+
+	if(!_values.empty()) {
+		_update(position, value, true);
+		return;
+	}
+
+	if(!_contains(index)) ++_size;
+	_sparse.insert(index, value);
+	_densify();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	std::size_t position = key<_tindex>::encode(index);
+	if(position >= universe<_tindex>::value) return;
+
+	if(!_values.empty()) {
+		if(_has(_capacity + position)) _update(position, _func(_values[_capacity + position], value), true);
+		else _update(position, value, true); // Not there yet, insert instead
+
+		return;
+	}
+
+	if(!_contains(index)) ++_size;
+	_sparse.apply(index, value);
+	_densify();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	std::size_t position = key<_tindex>::encode(index);
+	if(position >= universe<_tindex>::value) return;
+
+	if(!_values.empty()) {
+		_update(position, _tvalue(), false);
+		return;
+	}
+
+	if(_contains(index)) --_size;
+	_sparse.erase(index);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue flat_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	_tvalue result = _tvalue();
+	query(start, end, result);
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue flat_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool flat_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end, _tvalue& result) const {
+	if(_values.empty()) return _sparse.query(start, end, result);
+	return _query(key<_tindex>::encode(start), key<_tindex>::encode(end), result);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue flat_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end, thread_pool&, std::size_t) const {
+	return query(start, end);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue flat_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	if(_values.empty()) return _sparse[index];
+
+	std::size_t position = key<_tindex>::encode(index);
+	if(position >= universe<_tindex>::value || !_has(_capacity + position)) return _tvalue();
+	return _values[_capacity + position];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+template<class _predicate>
+bool flat_tree<_tvalue, _tindex, _functor>::search(_predicate predicate, _tindex& index) const {
+	if(_values.empty()) return _sparse.search(predicate, index);
+	if(!_has(1) || !predicate(_values[1])) return false;
+
+	std::size_t position = 1;
+	_tvalue prefix = _tvalue();
+	bool found = false;
+
+	// A child without any index is skipped, as it has no node in tree, and the prefix starts with the first child passed
+	while(position < _capacity) {
+		std::size_t left = position << 1;
+
+		if(!_has(left)) position = left | 1;
+		else if(!_has(left | 1)) position = left;
+		else {
+			_tvalue joined = found ? _func(prefix, _values[left]) : _values[left];
+
+			if(predicate(joined)) position = left;
+			else {
+				prefix = joined;
+				found = true;
+				position = left | 1;
+			}
+		}
+	}
+
+	index = key<_tindex>::decode(typename key<_tindex>::type(position - _capacity));
+	return true;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+template<class _function>
+void flat_tree<_tvalue, _tindex, _functor>::for_each(const _tindex& start, const _tindex& end, _function function) const {
+	if(_values.empty()) {
+		_sparse.for_each(start, end, function);
+		return;
+	}
+
+	std::size_t first = key<_tindex>::encode(start), last = key<_tindex>::encode(end);
+	if(last >= universe<_tindex>::value) last = universe<_tindex>::value - 1;
+
+	for(std::size_t position = first; position <= last; ++position) {
+		std::size_t bit = _capacity + position;
+		std::uint64_t word = _filled[bit >> 6] >> (bit & 63);
+
+		if(word == 0) { // Skip the rest of the word
+			position = (bit | 63) - _capacity;
+			continue;
+		}
+
+		if(word & 1)
+			function(key<_tindex>::decode(typename key<_tindex>::type(position)), _values[bit]);
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+template<class _function>
+void flat_tree<_tvalue, _tindex, _functor>::parallel_for_each(const _tindex& start, const _tindex& end, _function function,
+	thread_pool&, order) const {
+
+	for_each(start, end, function);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+template<class _iterator>
+void flat_tree<_tvalue, _tindex, _functor>::batch(_iterator first, _iterator last) {
+	if(_values.empty()) { // The pointer tree is small, and may turn into the array midway
+		for(; first != last; ++first) {
+			if(first->type == operation::insert) insert(first->index, first->value);
+			else if(first->type == operation::apply) apply(first->index, first->value);
+			else erase(first->index);
+		}
+
+		return;
+	}
+
+	std::vector<std::size_t> touched;
+
+	// Set the leaves in order, then recompute the ancestors level by level
+	for(; first != last; ++first) {
+		std::size_t position = key<_tindex>::encode(first->index);
+		if(position >= universe<_tindex>::value) continue;
+
+		_tvalue& leaf = _values[_capacity + position];
+
+		if(first->type == operation::erase) _set(position, _tvalue(), false);
+		else if(first->type == operation::apply && _has(_capacity + position)) _set(position, _func(leaf, first->value), true);
+		else _set(position, first->value, true);
+
+		touched.push_back(_capacity + position);
+	}
+
+	std::sort(touched.begin(), touched.end());
+
+	while(!touched.empty() && touched.front() > 1) {
+		for(std::size_t& position : touched) position >>= 1;
+		touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+		for(std::size_t position : touched) _pull(position);
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+template<class _iterator>
+void flat_tree<_tvalue, _tindex, _functor>::build(_iterator first, _iterator last) {
+	clear();
+
+	if(std::size_t(std::distance(first, last)) < _dense) {
+		_sparse.build(first, last);
+		_sparse.for_each(key<_tindex>::decode(typename key<_tindex>::type(0)),
+			key<_tindex>::decode(typename key<_tindex>::type(universe<_tindex>::value - 1)),
+			[this](const _tindex&, const _tvalue&) { ++_size; });
+
+		return;
+	}
+
+	_allocate();
+
+	for(; first != last; ++first) {
+		std::size_t position = key<_tindex>::encode(first->first);
+		if(position < universe<_tindex>::value) _set(position, first->second, true);
+	}
+
+	for(std::size_t position = _capacity - 1; position > 0; --position) _pull(position);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+template<class _iterator>
+void flat_tree<_tvalue, _tindex, _functor>::build(_iterator first, _iterator last, thread_pool&) {
+	build(first, last);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::clear() {
+	_sparse.clear();
+	_size = 0;
+
+	std::vector<_tvalue>().swap(_values);
+	std::vector<std::uint64_t>().swap(_filled);
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool flat_tree<_tvalue, _tindex, _functor>::_has(std::size_t position) const {
+	return _filled[position >> 6] >> (position & 63) & 1;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool flat_tree<_tvalue, _tindex, _functor>::_contains(const _tindex& index) const {
+	bool found = false;
+	_sparse.for_each(index, index, [&found](const _tindex&, const _tvalue&) { found = true; });
+	return found;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::_densify() {
+	if(_size < _dense) return;
+
+	_allocate();
+
+	_sparse.for_each(key<_tindex>::decode(typename key<_tindex>::type(0)),
+		key<_tindex>::decode(typename key<_tindex>::type(universe<_tindex>::value - 1)),
+		[this](const _tindex& index, const _tvalue& value) { _set(key<_tindex>::encode(index), value, true); });
+
+	for(std::size_t position = _capacity - 1; position > 0; --position) _pull(position);
+
+	_sparse.clear();
+	_size = 0;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::_allocate() {
+	_values.assign(_capacity << 1, _tvalue());
+	_filled.assign(((_capacity << 1) + 63) >> 6, 0);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::_set(std::size_t position, const _tvalue& value, bool present) {
+	position += _capacity;
+	_values[position] = value;
+
+	std::uint64_t mask = std::uint64_t(1) << (position & 63);
+	if(present) _filled[position >> 6] |= mask;
+	else _filled[position >> 6] &= ~mask;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::_pull(std::size_t position) {
+	std::size_t left = position << 1, right = left | 1;
+	bool lhs = _has(left), rhs = _has(right);
+
+	if(lhs && rhs) _values[position] = _func(_values[left], _values[right]);
+	else if(lhs) _values[position] = _values[left];
+	else if(rhs) _values[position] = _values[right];
+	else _values[position] = _tvalue();
+
+	std::uint64_t mask = std::uint64_t(1) << (position & 63);
+	if(lhs || rhs) _filled[position >> 6] |= mask;
+	else _filled[position >> 6] &= ~mask;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void flat_tree<_tvalue, _tindex, _functor>::_update(std::size_t position, const _tvalue& value, bool present) {
+	_set(position, value, present);
+	for(position = (_capacity + position) >> 1; position > 0; position >>= 1) _pull(position);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool flat_tree<_tvalue, _tindex, _functor>::_query(std::size_t start, std::size_t end, _tvalue& result) const {
+	if(end >= universe<_tindex>::value) end = universe<_tindex>::value - 1;
+	if(start > end) return false;
+
+	// Bottom-up, with separate accumulators so that the order is kept for non-commutative functors, each starting with the
+	// first node holding an index
+	_tvalue left = _tvalue(), right = _tvalue();
+	bool lhs = false, rhs = false;
+
+	for(start += _capacity, end += _capacity + 1; start < end; start >>= 1, end >>= 1) {
+		if(start & 1) {
+			if(_has(start)) {
+				left = lhs ? _func(left, _values[start]) : _values[start];
+				lhs = true;
+			}
+
+			++start;
+		}
+
+		if(end & 1) {
+			--end;
+
+			if(_has(end)) {
+				right = rhs ? _func(_values[end], right) : _values[end];
+				rhs = true;
+			}
+		}
+	}
+
+	if(lhs && rhs) result = _func(left, right);
+	else if(lhs) result = left;
+	else if(rhs) result = right;
+
+	return lhs || rhs;
+}
+
+}
+
+#endif
@@ -0,0 +1,209 @@
+/**
+ * @file key.hpp
+ * @brief Order-preserving mappings from index types to the unsigned keys used inside the trees.
+ */
+
+#ifndef DST_KEY_HPP_
+#define DST_KEY_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "bit.hpp"
+
+namespace dst {
+
+/**
+ * @brief Mapping between an index type and the unsigned key type the trees operate on.
+ *
+ * Every specialization provides an unsigned integral `type` together with `encode` and `decode`, such that `encode` is a
+ * bijection and `a < b` if and only if `encode(a) < encode(b)`. Working on unsigned keys lets the trees build their aligned
+ * blocks with plain bit operations regardless of the sign or the representation of the indices.
+ *
+ * @tparam _type The index type to be mapped.
+ */
+template<typename _type, typename = void>
+struct key;
+
+/**
+ * @brief Integral indices, mapped by flipping the sign bit of their two's complement representation.
+ */
+template<typename _type>
+struct key<_type, typename std::enable_if<std::is_integral<_type>::value>::type> {
+	using type = typename std::make_unsigned<_type>::type;
+
+	static constexpr type sign = std::is_signed<_type>::value ? type(type(1) << (sizeof(type) * 8 - 1)) : type(0);
+
+	static constexpr type encode(const _type& index) {
+		return type(type(index) ^ sign);
+	}
+
+	static constexpr _type decode(const type& index) {
+		return _type(type(index ^ sign));
+	}
+};
+
+/**
+ * @brief IEEE-754 floating-point indices, mapped by flipping the sign bit of non-negative numbers and every bit of
+ * negative ones.
+ *
+ * The mapping follows the bit patterns, so -0.0 and 0.0 are distinct indices (with -0.0 ordered first) and NaNs are placed
+ * beyond the infinities of their sign.
+ */
+template<typename _type>
+struct key<_type, typename std::enable_if<std::is_floating_point<_type>::value>::type> {
+	static_assert(sizeof(_type) == 4 || sizeof(_type) == 8, "Only single and double precision indices are supported");
+
+	using type = typename std::conditional<sizeof(_type) == 4, std::uint32_t, std::uint64_t>::type;
+
+	static constexpr type sign = type(type(1) << (sizeof(type) * 8 - 1));
+
+	static type encode(const _type& index) {
+		type bits;
+		std::memcpy(&bits, &index, sizeof(bits));
+		return (bits & sign) ? type(~bits) : type(bits | sign);
+	}
+
+	static _type decode(const type& index) {
+		type bits = (index & sign) ? type(index ^ sign) : type(~index);
+		_type result;
+		std::memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+};
+
+#ifdef __SIZEOF_INT128__
+
+/**
+ * @brief Unsigned 128-bit indices, such as IPv6 addresses, used as they are.
+ */
+template<>
+struct key<uint128> {
+	using type = uint128;
+
+	static constexpr type encode(const type& index) {
+		return index;
+	}
+
+	static constexpr type decode(const type& index) {
+		return index;
+	}
+};
+
+/**
+ * @brief Signed 128-bit indices, mapped by flipping the sign bit.
+ */
+template<>
+struct key<int128> {
+	using type = uint128;
+
+	static constexpr type sign = type(1) << 127;
+
+	static constexpr type encode(const int128& index) {
+		return type(index) ^ sign;
+	}
+
+	static constexpr int128 decode(const type& index) {
+		return int128(index ^ sign);
+	}
+};
+
+#endif
+
+/**
+ * @brief The smallest unsigned word holding a given amount of bytes.
+ */
+template<std::size_t _bytes, typename = void>
+struct word;
+
+template<std::size_t _bytes>
+struct word<_bytes, typename std::enable_if<(_bytes <= 4)>::type> {
+	using type = std::uint32_t;
+};
+
+template<std::size_t _bytes>
+struct word<_bytes, typename std::enable_if<(4 < _bytes && _bytes <= 8)>::type> {
+	using type = std::uint64_t;
+};
+
+#ifdef __SIZEOF_INT128__
+
+template<std::size_t _bytes>
+struct word<_bytes, typename std::enable_if<(8 < _bytes && _bytes <= 16)>::type> {
+	using type = uint128;
+};
+
+#endif
+
+/**
+ * @brief Composite indices ordered lexicographically, mapped by concatenating the keys of both components.
+ *
+ * The first component takes the high bits and the second the low bits, so a block of composite keys sharing the first
+ * component is contiguous and queries such as `{tenant, 0}` to `{tenant, max}` cover exactly one tenant. The combined key
+ * must fit in 64 bits, or in 128 bits where the compiler provides them.
+ */
+template<typename _tfirst, typename _tsecond>
+struct key<std::pair<_tfirst, _tsecond>> {
+	using type = typename word<sizeof(typename key<_tfirst>::type) + sizeof(typename key<_tsecond>::type)>::type;
+
+	static constexpr std::size_t shift = sizeof(typename key<_tsecond>::type) << 3;
+
+	static type encode(const std::pair<_tfirst, _tsecond>& index) {
+		return type(type(key<_tfirst>::encode(index.first)) << shift) | type(key<_tsecond>::encode(index.second));
+	}
+
+	static std::pair<_tfirst, _tsecond> decode(const type& index) {
+		return std::make_pair(key<_tfirst>::decode(typename key<_tfirst>::type(index >> shift)),
+			key<_tsecond>::decode(typename key<_tsecond>::type(index)));
+	}
+};
+
+/**
+ * @brief Index type for a universe declared at compile time, holding the integers from 0 to _size - 1.
+ *
+ * It converts from and to std::size_t, so trees indexed by it are used with plain integers.
+ *
+ * @tparam _size The amount of indices in the universe.
+ */
+template<std::size_t _size>
+struct bounded {
+	std::size_t value;
+
+	bounded(std::size_t index = 0) : value(index) {}
+	operator std::size_t() const { return value; }
+};
+
+template<std::size_t _size>
+struct key<bounded<_size>> {
+	using type = std::size_t;
+
+	static constexpr type encode(const bounded<_size>& index) {
+		return index.value;
+	}
+
+	static bounded<_size> decode(const type& index) {
+		return bounded<_size>(index);
+	}
+};
+
+/**
+ * @brief The amount of distinct indices of a type when it is small enough to be enumerated, or 0 otherwise.
+ *
+ * Integral types of at most 16 bits and bounded universes are small, and the trees indexed by them are specialized as flat
+ * arrays (see flat_tree).
+ */
+template<typename _type, typename = void>
+struct universe : std::integral_constant<std::size_t, 0> {};
+
+template<typename _type>
+struct universe<_type, typename std::enable_if<std::is_integral<_type>::value && !std::is_same<_type, bool>::value &&
+	sizeof(_type) <= 2>::type> : std::integral_constant<std::size_t, std::size_t(1) << (sizeof(_type) << 3)> {};
+
+template<std::size_t _size>
+struct universe<bounded<_size>> : std::integral_constant<std::size_t, _size> {};
+
+} // namespace dst
+
+#endif
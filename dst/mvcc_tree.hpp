@@ -0,0 +1,483 @@
+/**
+ * @file mvcc_tree.hpp
+ * @brief Implementation of the multi-version dynamic segment tree, read by transactions as of their start timestamp.
+ */
+
+#ifndef DST_MVCC_TREE_HPP_
+#define DST_MVCC_TREE_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "snapshot_tree.hpp"
+#include "tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The multi-version tree, whose readers see the version committed when they began, without blocking the writers.
+ *
+ * Every commit stamps its changes with the next timestamp and records the resulting version, a view of snapshot_tree which
+ * shares its unchanged nodes with the previous ones, in an index ordered by timestamp. A transaction holds the version it
+ * began on and queries it without any lock, however long it runs and whatever is committed meanwhile. Beginning and ending
+ * a transaction take a short mutex, to register its timestamp among the active ones.
+ *
+ * Compaction discards from the index the versions older than the oldest active transaction, or than the latest commit if
+ * there is none, keeping the newest version before it so that every active timestamp can still be read. It runs on a
+ * background thread at a given interval, or when called. The nodes of a discarded version are freed with the last
+ * transaction holding them.
+ *
+ * Writers are serialized by a mutex. Every method is safe to call from any thread, and the functor must not access the
+ * tree itself.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class mvcc_tree {
+public:
+	/**
+	 * @brief A read-only transaction on the version committed as of its timestamp.
+	 */
+	class transaction;
+
+	/**
+	 * @brief The operations of a commit.
+	 */
+	using operation = typename tree<_tvalue, _tindex, _functor>::operation;
+
+	/**
+	 * @brief Constructor for the tree, at timestamp 0 which is empty.
+	 * @param interval The interval between two background compactions, or zero to only compact when called.
+	 */
+	explicit mvcc_tree(std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+
+	mvcc_tree(const mvcc_tree&) = delete;
+	mvcc_tree& operator=(const mvcc_tree&) = delete;
+
+	/**
+	 * @brief Insert a value at a given index in the tree, as a commit of its own.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 * @return The timestamp of the commit.
+	 */
+	std::uint64_t insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree, as a commit of its own.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 * @return The timestamp of the commit.
+	 */
+	std::uint64_t apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree, as a commit of its own.
+	 * @param index The index to be removed.
+	 * @return The timestamp of the commit.
+	 */
+	std::uint64_t erase(const _tindex& index);
+
+	/**
+	 * @brief Perform operations in order as a single commit, seen whole or not at all by the transactions.
+	 *
+	 * If an operation throws, the tree is brought back to the version of the previous commit and the exception is rethrown,
+	 * so that none of the operations is published.
+	 *
+	 * @param first The first operation.
+	 * @param last The end of the operations.
+	 * @return The timestamp of the commit.
+	 */
+	template<class _iterator>
+	std::uint64_t commit(_iterator first, _iterator last);
+
+	/**
+	 * @brief Begin a transaction on the latest committed version.
+	 * @return The transaction.
+	 */
+	transaction begin() const;
+
+	/**
+	 * @brief Begin a transaction as of a past timestamp, reading the latest version committed by then.
+	 *
+	 * A timestamp later than the latest commit is lowered to it. The timestamp should not be older than the oldest active
+	 * transaction, since compaction may have discarded the versions before, in which case the oldest version kept is read.
+	 *
+	 * @param timestamp The timestamp to read as of.
+	 * @return The transaction.
+	 */
+	transaction begin(std::uint64_t timestamp) const;
+
+	/**
+	 * @brief The timestamp of the latest commit.
+	 */
+	std::uint64_t timestamp() const;
+
+	/**
+	 * @brief Discard the versions no active transaction can read.
+	 * @return The amount of versions kept.
+	 */
+	std::size_t compact();
+
+	/**
+	 * @brief Destructor for the tree, stopping the compaction. The transactions must have ended.
+	 */
+	~mvcc_tree();
+
+private:
+	/**
+	 * @brief An immutable version of the tree.
+	 */
+	using view = typename snapshot_tree<_tvalue, _tindex, _functor>::view;
+
+	/**
+	 * @brief The tree holding the latest version, only accessed by the writers.
+	 */
+	snapshot_tree<_tvalue, _tindex, _functor> _tree;
+
+	/**
+	 * @brief The mutex serializing the writers.
+	 */
+	std::mutex _writer;
+
+	/**
+	 * @brief The versions kept, by commit timestamp.
+	 */
+	std::map<std::uint64_t, view> _versions;
+
+	/**
+	 * @brief The timestamps of the active transactions.
+	 */
+	mutable std::multiset<std::uint64_t> _active;
+
+	/**
+	 * @brief The mutex guarding the versions and the active transactions.
+	 */
+	mutable std::mutex _registry;
+
+	/**
+	 * @brief The timestamp of the latest commit.
+	 */
+	std::uint64_t _clock;
+
+	/**
+	 * @brief The interval between two background compactions.
+	 */
+	std::chrono::milliseconds _interval;
+
+	/**
+	 * @brief Whether the tree is being destroyed, and the signal stopping the compaction early.
+	 */
+	bool _stop;
+	std::condition_variable _wake;
+
+	/**
+	 * @brief The thread running the background compaction, if any, started last.
+	 */
+	std::thread _compactor;
+
+	/**
+	 * @brief Internal function to record the latest version under the next timestamp, with the writer lock held.
+	 * @return The timestamp of the commit.
+	 */
+	std::uint64_t _publish();
+
+	/**
+	 * @brief Internal function to register a transaction and take its version.
+	 * @param timestamp The timestamp of the transaction, set to the latest commit if later or asked for.
+	 * @param latest Whether the transaction reads the latest commit.
+	 * @return The version as of the timestamp.
+	 */
+	view _enter(std::uint64_t& timestamp, bool latest) const;
+
+	/**
+	 * @brief Internal function to unregister a transaction.
+	 * @param timestamp The timestamp of the transaction.
+	 */
+	void _leave(std::uint64_t timestamp) const;
+
+	/**
+	 * @brief Internal function run by the compaction thread.
+	 */
+	void _compact_loop();
+};
+
+template<typename _tvalue, typename _tindex, class _functor>
+class mvcc_tree<_tvalue, _tindex, _functor>::transaction {
+public:
+	transaction(const transaction&) = delete;
+	transaction& operator=(const transaction&) = delete;
+
+	/**
+	 * @brief Move constructor for the transaction, ending the other.
+	 * @param other The transaction to move.
+	 */
+	transaction(transaction&& other);
+
+	/**
+	 * @brief The timestamp the transaction reads as of.
+	 */
+	std::uint64_t timestamp() const;
+
+	/**
+	 * @brief Aggregate the values in the given range in the version of the transaction. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range in the version of the transaction. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the version of the transaction.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Destructor for the transaction, ending it.
+	 */
+	~transaction();
+
+private:
+	friend class mvcc_tree;
+
+	/**
+	 * @brief Constructor for a transaction, registering it.
+	 * @param owner The tree.
+	 * @param timestamp The timestamp to read as of.
+	 * @param latest Whether to read the latest commit instead.
+	 */
+	transaction(const mvcc_tree* owner, std::uint64_t timestamp, bool latest);
+
+	/**
+	 * @brief The tree, null once the transaction is moved from.
+	 */
+	const mvcc_tree* _owner;
+
+	/**
+	 * @brief The timestamp of the transaction.
+	 */
+	std::uint64_t _timestamp;
+
+	/**
+	 * @brief The version read by the transaction.
+	 */
+	view _version;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+mvcc_tree<_tvalue, _tindex, _functor>::mvcc_tree(std::chrono::milliseconds interval)
+	: _clock(0), _interval(interval), _stop(false) {
+
+	_versions.emplace(0, _tree.snapshot());
+	if(_interval.count() > 0) _compactor = std::thread([this] { _compact_loop(); });
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+mvcc_tree<_tvalue, _tindex, _functor>::~mvcc_tree() {
+	{
+		std::lock_guard<std::mutex> guard(_registry);
+		_stop = true;
+	}
+
+	_wake.notify_one();
+	if(_compactor.joinable()) _compactor.join();
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::uint64_t mvcc_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<std::mutex> guard(_writer);
+	_tree.insert(index, value);
+	return _publish();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::uint64_t mvcc_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<std::mutex> guard(_writer);
+	_tree.apply(index, value);
+	return _publish();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::uint64_t mvcc_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	std::lock_guard<std::mutex> guard(_writer);
+	_tree.erase(index);
+	return _publish();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+template<class _iterator>
+std::uint64_t mvcc_tree<_tvalue, _tindex, _functor>::commit(_iterator first, _iterator last) {
+	std::lock_guard<std::mutex> guard(_writer);
+
+	// The version before the commit shares its nodes instead of being modified, so that it can be restored
+	view before = _tree.snapshot();
+
+	try {
+		for(; first != last; ++first) {
+			if(first->type == operation::insert) _tree.insert(first->index, first->value);
+			else if(first->type == operation::apply) _tree.apply(first->index, first->value);
+			else _tree.erase(first->index);
+		}
+	}
+	catch(...) {
+		_tree.restore(before);
+		throw;
+	}
+
+	return _publish();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename mvcc_tree<_tvalue, _tindex, _functor>::transaction mvcc_tree<_tvalue, _tindex, _functor>::begin() const {
+	return transaction(this, 0, true);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename mvcc_tree<_tvalue, _tindex, _functor>::transaction
+mvcc_tree<_tvalue, _tindex, _functor>::begin(std::uint64_t timestamp) const {
+	return transaction(this, timestamp, false);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::uint64_t mvcc_tree<_tvalue, _tindex, _functor>::timestamp() const {
+	std::lock_guard<std::mutex> guard(_registry);
+	return _clock;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t mvcc_tree<_tvalue, _tindex, _functor>::compact() {
+	std::vector<view> discarded;
+	std::size_t kept;
+
+	{
+		std::lock_guard<std::mutex> guard(_registry);
+		std::uint64_t oldest = _active.empty() ? _clock : *_active.begin();
+
+		// Keep the newest version committed by the oldest timestamp, which is the one it reads
+		auto keep = std::prev(_versions.upper_bound(oldest));
+
+		for(auto cur = _versions.begin(); cur != keep; ++cur) discarded.push_back(cur->second);
+		_versions.erase(_versions.begin(), keep);
+		kept = _versions.size();
+	}
+
+	// The nodes only held by the discarded versions are freed here, outside of the lock
+	return kept;
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::uint64_t mvcc_tree<_tvalue, _tindex, _functor>::_publish() {
+	view version = _tree.snapshot();
+
+	std::lock_guard<std::mutex> guard(_registry);
+	_versions.emplace(++_clock, version);
+	return _clock;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename mvcc_tree<_tvalue, _tindex, _functor>::view mvcc_tree<_tvalue, _tindex, _functor>::_enter(std::uint64_t& timestamp, bool latest) const {
+	std::lock_guard<std::mutex> guard(_registry);
+
+	if(latest || _clock < timestamp) timestamp = _clock;
+	_active.insert(timestamp);
+
+	auto found = _versions.upper_bound(timestamp);
+	if(found != _versions.begin()) --found;
+	return found->second;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void mvcc_tree<_tvalue, _tindex, _functor>::_leave(std::uint64_t timestamp) const {
+	std::lock_guard<std::mutex> guard(_registry);
+	_active.erase(_active.find(timestamp));
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void mvcc_tree<_tvalue, _tindex, _functor>::_compact_loop() {
+	std::unique_lock<std::mutex> guard(_registry);
+
+	while(!_stop) {
+		_wake.wait_for(guard, _interval);
+		if(_stop) return;
+
+		guard.unlock();
+		compact();
+		guard.lock();
+	}
+}
+
+/**
+ ***************************************** Transaction methods ****************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+mvcc_tree<_tvalue, _tindex, _functor>::transaction::transaction(const mvcc_tree* owner, std::uint64_t timestamp, bool latest)
+	: _owner(owner), _timestamp(timestamp), _version(owner->_enter(_timestamp, latest)) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+mvcc_tree<_tvalue, _tindex, _functor>::transaction::transaction(transaction&& other)
+	: _owner(other._owner), _timestamp(other._timestamp), _version(other._version) {
+
+	other._owner = nullptr;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+mvcc_tree<_tvalue, _tindex, _functor>::transaction::~transaction() {
+	if(_owner != nullptr) _owner->_leave(_timestamp);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::uint64_t mvcc_tree<_tvalue, _tindex, _functor>::transaction::timestamp() const {
+	return _timestamp;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue mvcc_tree<_tvalue, _tindex, _functor>::transaction::query(const _tindex& start, const _tindex& end) const {
+	return _version.query(start, end);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue mvcc_tree<_tvalue, _tindex, _functor>::transaction::query(const std::pair<_tindex, _tindex>& range) const {
+	return _version.query(range);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue mvcc_tree<_tvalue, _tindex, _functor>::transaction::operator[](const _tindex& index) const {
+	return _version[index];
+}
+
+}
+
+#endif
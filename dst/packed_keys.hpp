@@ -0,0 +1,262 @@
+/**
+ * @file packed_keys.hpp
+ * @brief Implementation of the delta-compressed sequence of increasing keys.
+ */
+
+#ifndef DST_PACKED_KEYS_HPP_
+#define DST_PACKED_KEYS_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "bit.hpp"
+
+namespace dst {
+
+/**
+ * @brief A sequence of strictly increasing keys, compressed by blocks as a base key and bit-packed deltas.
+ *
+ * Keys are appended to a raw tail, and every full block of 128 keys is sealed as its first key followed by the distance of
+ * each key to it, packed with the least amount of bits holding the largest one. Nearby keys, such as timestamps a few
+ * units apart, thus take a byte or two each instead of a full word. Every key stays accessible in O(1) by extracting its
+ * bits, and searches run a binary search over the block bases followed by one inside the block.
+ *
+ * @tparam _tkey The unsigned key type, as given by key.
+ */
+template<typename _tkey>
+class packed_keys {
+public:
+	/**
+	 * @brief Constructor for the sequence.
+	 */
+	packed_keys();
+
+	/**
+	 * @brief Append a key to the sequence.
+	 * @param index The key to append, which must be larger than the last one.
+	 */
+	void push_back(const _tkey& index);
+
+	/**
+	 * @brief Access a key of the sequence.
+	 * @param position The position of the key.
+	 * @return The key at the position.
+	 */
+	_tkey operator[](std::size_t position) const;
+
+	/**
+	 * @brief The last key of the sequence, which must not be empty.
+	 */
+	_tkey back() const;
+
+	/**
+	 * @brief Find the position of the first key not less than a given one.
+	 * @param index The key to look for.
+	 * @return The position of the first key not less than the given one, or the size if there is none.
+	 */
+	std::size_t lower_bound(const _tkey& index) const;
+
+	/**
+	 * @brief Find the position of the first key greater than a given one.
+	 * @param index The key to look for.
+	 * @return The position of the first key greater than the given one, or the size if there is none.
+	 */
+	std::size_t upper_bound(const _tkey& index) const;
+
+	/**
+	 * @brief The amount of keys in the sequence.
+	 */
+	std::size_t size() const;
+
+	/**
+	 * @brief Whether the sequence is empty.
+	 */
+	bool empty() const;
+
+	/**
+	 * @brief Clear the sequence, releasing its memory.
+	 */
+	void clear();
+
+private:
+	/**
+	 * @brief The amount of keys in a sealed block.
+	 */
+	static constexpr std::size_t _block = 128;
+
+	/**
+	 * @brief The first key of every sealed block.
+	 */
+	std::vector<_tkey> _bases;
+
+	/**
+	 * @brief The amount of bits of each delta, for every sealed block.
+	 */
+	std::vector<unsigned char> _widths;
+
+	/**
+	 * @brief The position of the first word of every sealed block.
+	 */
+	std::vector<std::size_t> _offsets;
+
+	/**
+	 * @brief The packed deltas of all the sealed blocks.
+	 */
+	std::vector<std::uint64_t> _words;
+
+	/**
+	 * @brief The keys not sealed yet, fewer than a block.
+	 */
+	std::vector<_tkey> _tail;
+
+	/**
+	 * @brief Internal function to read a key of a sealed block.
+	 * @param block The block.
+	 * @param slot The position of the key in the block.
+	 * @return The key.
+	 */
+	_tkey _read(std::size_t block, std::size_t slot) const;
+
+	/**
+	 * @brief Internal function to seal the tail as a new block.
+	 */
+	void _seal();
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tkey>
+packed_keys<_tkey>::packed_keys() {}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tkey>
+void packed_keys<_tkey>::push_back(const _tkey& index) {
+	_tail.push_back(index);
+	if(_tail.size() == _block) _seal();
+}
+
+template<typename _tkey>
+_tkey packed_keys<_tkey>::operator[](std::size_t position) const {
+	std::size_t block = position / _block;
+	if(block < _bases.size()) return _read(block, position % _block);
+	return _tail[position - _bases.size() * _block];
+}
+
+template<typename _tkey>
+_tkey packed_keys<_tkey>::back() const {
+	if(!_tail.empty()) return _tail.back();
+	return _read(_bases.size() - 1, _block - 1);
+}
+
+template<typename _tkey>
+std::size_t packed_keys<_tkey>::lower_bound(const _tkey& index) const {
+	std::size_t sealed = _bases.size();
+
+	// The last sealed block starting at or below the key
+	std::size_t block = std::upper_bound(_bases.begin(), _bases.end(), index) - _bases.begin();
+
+	if(block > 0) {
+		--block;
+
+		std::size_t low = 0, high = _block;
+		while(low < high) {
+			std::size_t mid = (low + high) >> 1;
+			if(_read(block, mid) < index) low = mid + 1;
+			else high = mid;
+		}
+
+		if(low < _block || block + 1 < sealed) return block * _block + low;
+	}
+	else if(sealed > 0) return 0;
+
+	return sealed * _block + (std::lower_bound(_tail.begin(), _tail.end(), index) - _tail.begin());
+}
+
+template<typename _tkey>
+std::size_t packed_keys<_tkey>::upper_bound(const _tkey& index) const {
+	if(index == _tkey(~_tkey(0))) return size();
+	return lower_bound(_tkey(index + 1));
+}
+
+template<typename _tkey>
+std::size_t packed_keys<_tkey>::size() const {
+	return _bases.size() * _block + _tail.size();
+}
+
+template<typename _tkey>
+bool packed_keys<_tkey>::empty() const {
+	return _bases.empty() && _tail.empty();
+}
+
+template<typename _tkey>
+void packed_keys<_tkey>::clear() {
+	std::vector<_tkey>().swap(_bases);
+	std::vector<unsigned char>().swap(_widths);
+	std::vector<std::size_t>().swap(_offsets);
+	std::vector<std::uint64_t>().swap(_words);
+	std::vector<_tkey>().swap(_tail);
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tkey>
+_tkey packed_keys<_tkey>::_read(std::size_t block, std::size_t slot) const {
+	std::size_t width = _widths[block];
+	std::size_t position = (_offsets[block] << 6) + slot * width;
+	_tkey delta = 0;
+
+	// A delta spans at most one word boundary per 64 bits
+	for(std::size_t done = 0; done < width;) {
+		std::size_t shift = position & 63, take = std::min<std::size_t>(64 - shift, width - done);
+		std::uint64_t bits = _words[position >> 6] >> shift;
+		if(take < 64) bits &= (std::uint64_t(1) << take) - 1;
+
+		delta |= _tkey(_tkey(bits) << done);
+		done += take;
+		position += take;
+	}
+
+	return _tkey(_bases[block] + delta);
+}
+
+template<typename _tkey>
+void packed_keys<_tkey>::_seal() {
+	_tkey base = _tail.front();
+	std::size_t width = bit::log(_tkey(_tail.back() - base)) + 1;
+
+	_bases.push_back(base);
+	_widths.push_back((unsigned char)width);
+	_offsets.push_back(_words.size());
+
+	std::size_t position = _words.size() << 6;
+	_words.resize(_words.size() + ((_block * width + 63) >> 6), 0);
+
+	for(const _tkey& index : _tail) {
+		_tkey delta = _tkey(index - base);
+
+		for(std::size_t done = 0; done < width;) {
+			std::size_t shift = position & 63, take = std::min<std::size_t>(64 - shift, width - done);
+			std::uint64_t bits = std::uint64_t(delta >> done);
+			if(take < 64) bits &= (std::uint64_t(1) << take) - 1;
+
+			_words[position >> 6] |= bits << shift;
+			done += take;
+			position += take;
+		}
+	}
+
+	_tail.clear();
+}
+
+}
+
+#endif
@@ -0,0 +1,650 @@
+/**
+ * @file radix_tree.hpp
+ * @brief Implementation of the adaptive radix variant of the dynamic segment tree.
+ */
+
+#ifndef DST_RADIX_TREE_HPP_
+#define DST_RADIX_TREE_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+#include "bit.hpp"
+#include "key.hpp"
+
+namespace dst {
+
+/**
+ * @brief The adaptive radix variant of the dynamic segment tree.
+ *
+ * This class offers the interface of tree over a radix tree which consumes the keys a byte at a time. Inner nodes adapt
+ * their capacity to the amount of children they hold, in the fashion of adaptive radix trees:
+ *
+ * - Nodes of 4, 16 and 48 children keep their child bytes sorted, next to the children and their aggregates.
+ *
+ * - Nodes of 256 children are indexed directly by the byte, with the child aggregates laid out as an implicit segment tree.
+ *
+ * Levels where all the keys share the same byte are skipped through path compression, so a node only exists where the keys
+ * branch and the height is bounded by the byte width of the keys. Each node keeps the aggregates of its children in key
+ * order, which lets a range query combine the fully covered children without visiting them.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class radix_tree {
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	radix_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree by deleting all the nodes.
+	 */
+	void clear();
+
+	/**
+	 * @brief Destructor for the tree.
+	 */
+	~radix_tree();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The node structure of the tree.
+	 *
+	 * A leaf holds its key and value. An inner node holds the key bits above its byte (the lower ones cleared), the
+	 * position of the byte selecting its children, and the aggregate of its subtree. Its arrays hold the children, the
+	 * child bytes, and the child aggregates. A node of 256 slots lays the aggregates out as an implicit segment tree of 512
+	 * slots instead, its bytes then flagging which of those slots cover at least one child so that empty ones are skipped.
+	 */
+	class node {
+	private:
+		_tkey _prefix;
+		unsigned char _shift;
+		unsigned short _count;
+		unsigned short _capacity;
+		_tvalue _value;
+
+		unsigned char* _bytes;
+		node** _children;
+		_tvalue* _values;
+
+	public:
+		node(const _tkey& index, const _tvalue& value)
+			: _prefix(index), _shift(0), _count(0), _capacity(0), _value(value),
+			_bytes(nullptr), _children(nullptr), _values(nullptr) {}
+
+		node(const _tkey& prefix, unsigned char shift)
+			: _prefix(prefix), _shift(shift), _count(0), _capacity(0), _value(),
+			_bytes(nullptr), _children(nullptr), _values(nullptr) {}
+
+		node(const node&) = delete;
+		node& operator=(const node&) = delete;
+
+		~node() {
+			delete[] _bytes;
+			delete[] _children;
+			delete[] _values;
+		}
+
+		bool leaf() const { return _children == nullptr; }
+
+		_tkey& prefix() { return _prefix; }
+		unsigned char shift() const { return _shift; }
+		unsigned short& count() { return _count; }
+		unsigned short& capacity() { return _capacity; }
+		_tvalue& value() { return _value; }
+
+		unsigned char*& bytes() { return _bytes; }
+		node**& children() { return _children; }
+		_tvalue*& values() { return _values; }
+	};
+
+	/**
+	 * @brief The root node of the tree.
+	 */
+	node* _root;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to find the slot of a child.
+	 * @param cur The current inner node.
+	 * @param byte The byte of the child.
+	 * @return The slot of the child, or -1 if it does not exist.
+	 */
+	static int _find(node* cur, unsigned char byte);
+
+	/**
+	 * @brief Internal function to recompute a slot of the implicit segment tree of a node of 256 slots from its halves.
+	 * @param cur The current inner node.
+	 * @param slot The slot to recompute.
+	 */
+	void _join(node* cur, int slot);
+
+	/**
+	 * @brief Internal function to change the capacity of an inner node, keeping its children in order.
+	 * @param cur The current inner node.
+	 * @param capacity The new capacity, one of 4, 16, 48 or 256.
+	 */
+	void _resize(node* cur, unsigned short capacity);
+
+	/**
+	 * @brief Internal function to add a child to an inner node, growing it if full.
+	 * @param cur The current inner node.
+	 * @param byte The byte of the child, which must not be taken yet.
+	 * @param child The child to add.
+	 */
+	void _attach(node* cur, unsigned char byte, node* child);
+
+	/**
+	 * @brief Internal function to remove a child from an inner node, shrinking it if sparse enough.
+	 * @param cur The current inner node.
+	 * @param slot The slot of the child.
+	 */
+	void _detach(node* cur, int slot);
+
+	/**
+	 * @brief Internal function to refresh the aggregate of a child in its parent and the aggregate of the parent.
+	 * @param cur The current inner node.
+	 * @param slot The slot of the child.
+	 */
+	void _update(node* cur, int slot);
+
+	/**
+	 * @brief Internal function to recompute the aggregate of an inner node from its child aggregates.
+	 * @param cur The current inner node.
+	 */
+	void _pull(node* cur);
+
+	/**
+	 * @brief Internal function to join a subtree and a key outside of it under a new inner node.
+	 *
+	 * The new node branches on the byte holding the highest bit where the key differs from the subtree, which compresses
+	 * away the levels both share.
+	 *
+	 * @param cur The root of the subtree.
+	 * @param index The key outside of the subtree.
+	 * @param value The value of the key.
+	 * @return The new inner node.
+	 */
+	node* _split(node* cur, const _tkey& index, const _tvalue& value);
+
+	/**
+	 * @brief Internal function to insert or aggregate a value at a given index in the tree.
+	 * @param cur The current node.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 * @param combine Whether to aggregate the value to an existing one instead of replacing it.
+	 * @return The new root of the subtree.
+	 */
+	node* _insert(node* cur, const _tkey& index, const _tvalue& value, bool combine);
+
+	/**
+	 * @brief Internal function to erase a value at a given index in the tree.
+	 *
+	 * Inner nodes left with a single child are replaced by it to keep the paths compressed.
+	 *
+	 * @param cur The current node.
+	 * @param index The index to erase the value.
+	 * @return The new root of the subtree.
+	 */
+	node* _erase(node* cur, const _tkey& index);
+
+	/**
+	 * @brief Internal function to aggregate the nodes covering a range into a result, in key order.
+	 *
+	 * Only the children holding the endpoints of the range are visited, the ones between are combined from the child
+	 * aggregates of the node. Only the values found are aggregated, the first one replacing the result, as in tree.
+	 *
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @param result The aggregate value so far.
+	 * @param found Whether a value was aggregated so far.
+	 */
+	void _query(node* cur, const std::pair<_tkey, _tkey>& segment, _tvalue& result, bool& found) const;
+
+	/**
+	 * @brief Internal function to clear the tree.
+	 * @param cur The current node.
+	 */
+	void _clear(node* cur);
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+radix_tree<_tvalue, _tindex, _functor>::radix_tree() : _root(nullptr) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+radix_tree<_tvalue, _tindex, _functor>::~radix_tree() {
+	clear();
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	_root = _insert(_root, key<_tindex>::encode(index), value, false);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	_root = _insert(_root, key<_tindex>::encode(index), value, true);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	_root = _erase(_root, key<_tindex>::encode(index));
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue radix_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	return query(std::make_pair(start, end));
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue radix_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	_tvalue result = _tvalue();
+	bool found = false;
+
+	_query(_root, std::make_pair(key<_tindex>::encode(range.first), key<_tindex>::encode(range.second)), result, found);
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue radix_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+	node* cur = _root;
+
+	while(cur != nullptr && !cur->leaf()) {
+		if(((cur->prefix() ^ target) >> cur->shift()) >> 8) return _tvalue(); // Outside of the node
+
+		int slot = _find(cur, (unsigned char)(target >> cur->shift()));
+		if(slot < 0) return _tvalue();
+		cur = cur->children()[slot];
+	}
+
+	if(cur == nullptr || cur->prefix() != target) return _tvalue();
+	return cur->value();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::clear() {
+	_clear(_root);
+	_root = nullptr;
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+int radix_tree<_tvalue, _tindex, _functor>::_find(node* cur, unsigned char byte) {
+	if(cur->capacity() == 256) return cur->children()[byte] ? byte : -1;
+
+	for(int slot = 0; slot < cur->count(); ++slot) {
+		if(cur->bytes()[slot] == byte) return slot;
+		if(cur->bytes()[slot] > byte) break; // Sorted, so it is not there
+	}
+
+	return -1;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::_join(node* cur, int slot) {
+	unsigned char* filled = cur->bytes();
+	_tvalue* values = cur->values();
+	int left = slot << 1, right = slot << 1 | 1;
+
+	filled[slot] = filled[left] | filled[right];
+	if(filled[left] && filled[right]) values[slot] = _func(values[left], values[right]);
+	else if(filled[left]) values[slot] = values[left];
+	else if(filled[right]) values[slot] = values[right];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::_resize(node* cur, unsigned short capacity) {
+	// Gather the children in key order
+	unsigned char bytes[256];
+	node* children[256];
+	int count = 0;
+
+	if(cur->capacity() == 256) {
+		for(int byte = 0; byte < 256; ++byte) {
+			if(cur->children()[byte] == nullptr) continue;
+			bytes[count] = (unsigned char)byte;
+			children[count++] = cur->children()[byte];
+		}
+	}
+	else {
+		for(; count < cur->count(); ++count) {
+			bytes[count] = cur->bytes()[count];
+			children[count] = cur->children()[count];
+		}
+	}
+
+	delete[] cur->bytes();
+	delete[] cur->children();
+	delete[] cur->values();
+
+	cur->capacity() = capacity;
+	cur->bytes() = (capacity == 256) ? new unsigned char[512]() : new unsigned char[capacity];
+	cur->children() = new node*[capacity]();
+	cur->values() = new _tvalue[(capacity == 256) ? 512 : capacity]();
+
+	if(capacity == 256) {
+		for(int slot = 0; slot < count; ++slot) {
+			cur->children()[bytes[slot]] = children[slot];
+			cur->values()[256 + bytes[slot]] = children[slot]->value();
+			cur->bytes()[256 + bytes[slot]] = 1;
+		}
+
+		for(int slot = 255; slot > 0; --slot) _join(cur, slot);
+	}
+	else {
+		for(int slot = 0; slot < count; ++slot) {
+			cur->bytes()[slot] = bytes[slot];
+			cur->children()[slot] = children[slot];
+			cur->values()[slot] = children[slot]->value();
+		}
+	}
+
+	_pull(cur);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::_attach(node* cur, unsigned char byte, node* child) {
+	if(cur->count() == cur->capacity())
+		_resize(cur, (cur->capacity() < 4) ? 4 : (cur->capacity() == 4) ? 16 : (cur->capacity() == 16) ? 48 : 256);
+
+	++cur->count();
+
+	if(cur->capacity() == 256) {
+		cur->children()[byte] = child;
+		_update(cur, byte);
+		return;
+	}
+
+	// Shift the larger bytes to keep the slots sorted
+	int slot = cur->count() - 1;
+	for(; slot > 0 && cur->bytes()[slot - 1] > byte; --slot) {
+		cur->bytes()[slot] = cur->bytes()[slot - 1];
+		cur->children()[slot] = cur->children()[slot - 1];
+		cur->values()[slot] = cur->values()[slot - 1];
+	}
+
+	cur->bytes()[slot] = byte;
+	cur->children()[slot] = child;
+	_update(cur, slot);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::_detach(node* cur, int slot) {
+	--cur->count();
+
+	if(cur->capacity() == 256) {
+		cur->children()[slot] = nullptr;
+		_update(cur, slot);
+	}
+	else {
+		for(; slot < cur->count(); ++slot) {
+			cur->bytes()[slot] = cur->bytes()[slot + 1];
+			cur->children()[slot] = cur->children()[slot + 1];
+			cur->values()[slot] = cur->values()[slot + 1];
+		}
+
+		cur->children()[slot] = nullptr;
+		_pull(cur);
+	}
+
+	// Shrink with some slack to avoid resizing back and forth
+	if(cur->capacity() == 256 && cur->count() <= 36) _resize(cur, 48);
+	else if(cur->capacity() == 48 && cur->count() <= 12) _resize(cur, 16);
+	else if(cur->capacity() == 16 && cur->count() <= 3) _resize(cur, 4);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::_update(node* cur, int slot) {
+	if(cur->capacity() != 256) {
+		cur->values()[slot] = cur->children()[slot]->value();
+		_pull(cur);
+		return;
+	}
+
+	// Walk up the implicit segment tree of the child aggregates
+	cur->bytes()[256 + slot] = (cur->children()[slot] != nullptr);
+	if(cur->children()[slot] != nullptr) cur->values()[256 + slot] = cur->children()[slot]->value();
+
+	for(slot = (256 + slot) >> 1; slot > 0; slot >>= 1) _join(cur, slot);
+
+	_pull(cur);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::_pull(node* cur) {
+	if(cur->capacity() == 256) {
+		cur->value() = cur->values()[1];
+		return;
+	}
+
+	_tvalue result = cur->values()[0];
+	for(int slot = 1; slot < cur->count(); ++slot) result = _func(result, cur->values()[slot]);
+	cur->value() = result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename radix_tree<_tvalue, _tindex, _functor>::node*
+radix_tree<_tvalue, _tindex, _functor>::_split(node* cur, const _tkey& index, const _tvalue& value) {
+	// Branch on the byte of the highest differing bit
+	unsigned char shift = (unsigned char)(bit::log(_tkey(cur->prefix() ^ index)) & ~std::size_t(7));
+	_tkey mask = _tkey(((_tkey(1) << shift) << 8) - 1);
+
+	node* par = new node(_tkey(index & ~mask), shift);
+	_attach(par, (unsigned char)(cur->prefix() >> shift), cur);
+	_attach(par, (unsigned char)(index >> shift), new node(index, value));
+
+	return par;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename radix_tree<_tvalue, _tindex, _functor>::node*
+radix_tree<_tvalue, _tindex, _functor>::_insert(node* cur, const _tkey& index, const _tvalue& value, bool combine) {
+	if(cur == nullptr) return new node(index, value);
+
+	if(cur->leaf()) {
+		if(cur->prefix() != index) return _split(cur, index, value);
+
+		// Collided, update the value
+		cur->value() = combine ? _func(cur->value(), value) : value;
+		return cur;
+	}
+
+	if(((cur->prefix() ^ index) >> cur->shift()) >> 8) // Outside? Better split
+		return _split(cur, index, value);
+
+	unsigned char byte = (unsigned char)(index >> cur->shift());
+	int slot = _find(cur, byte);
+
+	if(slot < 0) {
+		_attach(cur, byte, new node(index, value));
+		return cur;
+	}
+
+	cur->children()[slot] = _insert(cur->children()[slot], index, value, combine);
+	_update(cur, slot);
+	return cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename radix_tree<_tvalue, _tindex, _functor>::node*
+radix_tree<_tvalue, _tindex, _functor>::_erase(node* cur, const _tkey& index) {
+	if(cur == nullptr) return nullptr;
+
+	if(cur->leaf()) { // Only erase if found
+		if(cur->prefix() != index) return cur;
+		delete cur;
+		return nullptr;
+	}
+
+	if(((cur->prefix() ^ index) >> cur->shift()) >> 8) return cur; // Not in the tree
+
+	int slot = _find(cur, (unsigned char)(index >> cur->shift()));
+	if(slot < 0) return cur;
+
+	cur->children()[slot] = _erase(cur->children()[slot], index);
+	if(cur->children()[slot] != nullptr) {
+		_update(cur, slot);
+		return cur;
+	}
+
+	_detach(cur, slot);
+
+	if(cur->count() == 1) { // Compress the path through the excessive node
+		node* child = nullptr;
+		for(int other = 0; child == nullptr; ++other) child = cur->children()[other];
+
+		delete cur;
+		return child;
+	}
+
+	return cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::_query(node* cur, const std::pair<_tkey, _tkey>& segment, _tvalue& result,
+	bool& found) const {
+
+	if(cur == nullptr) return;
+
+	auto take = [&](const _tvalue& value) {
+		result = found ? _func(result, value) : value;
+		found = true;
+	};
+
+	if(cur->leaf()) {
+		if(segment.first <= cur->prefix() && cur->prefix() <= segment.second) take(cur->value());
+		return;
+	}
+
+	_tkey mask = _tkey(((_tkey(1) << cur->shift()) << 8) - 1);
+	_tkey first = cur->prefix(), last = _tkey(cur->prefix() | mask);
+
+	if(segment.second < first || last < segment.first) return;
+	if(segment.first <= first && last <= segment.second) {
+		take(cur->value());
+		return;
+	}
+
+	// Bytes of the children holding the endpoints, those in between are fully covered
+	int low = (segment.first <= first) ? 0 : (unsigned char)(segment.first >> cur->shift());
+	int high = (last <= segment.second) ? 255 : (unsigned char)(segment.second >> cur->shift());
+
+	if(cur->capacity() == 256) {
+		_query(cur->children()[low], segment, result, found);
+		if(low == high) return;
+
+		// The right side of the implicit segment tree is gathered backwards, so it is kept apart until the end
+		unsigned char* filled = cur->bytes();
+		_tvalue* values = cur->values();
+		_tvalue right = _tvalue();
+		bool any = false;
+
+		for(int l = low + 257, r = high + 256; l < r; l >>= 1, r >>= 1) {
+			if(l & 1) {
+				if(filled[l]) take(values[l]);
+				++l;
+			}
+			if(r & 1) {
+				if(filled[--r]) right = any ? _func(values[r], right) : values[r];
+				any |= filled[r];
+			}
+		}
+
+		if(any) take(right);
+		_query(cur->children()[high], segment, result, found);
+		return;
+	}
+
+	for(int slot = 0; slot < cur->count(); ++slot) {
+		int byte = cur->bytes()[slot];
+		if(byte < low) continue;
+		if(byte > high) break;
+
+		if(byte == low || byte == high) _query(cur->children()[slot], segment, result, found);
+		else take(cur->values()[slot]);
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void radix_tree<_tvalue, _tindex, _functor>::_clear(node* cur) {
+	if(cur == nullptr) return;
+
+	if(!cur->leaf()) {
+		int slots = cur->capacity();
+		for(int slot = 0; slot < slots; ++slot) _clear(cur->children()[slot]);
+	}
+
+	delete cur;
+}
+
+}
+
+#endif
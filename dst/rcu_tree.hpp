@@ -0,0 +1,412 @@
+/**
+ * @file rcu_tree.hpp
+ * @brief Implementation of the dynamic segment tree with lock-free readers, in the manner of read-copy-update.
+ */
+
+#ifndef DST_RCU_TREE_HPP_
+#define DST_RCU_TREE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "bit.hpp"
+#include "epoch.hpp"
+#include "key.hpp"
+
+namespace dst {
+
+/**
+ * @brief The read-copy-update tree, whose readers never lock nor wait for the writers.
+ *
+ * This class has the interface of tree, but its nodes hold their range as a pair of keys and are never modified once
+ * published. A writer copies the path from the root to the index it changes, sharing every other subtree with the current version, and publishes the
+ * copy by swapping the root atomically. Readers load the root once and traverse a version that stays consistent for the
+ * whole query, so their latency does not depend on the writes. The nodes replaced by a write are retired, and deleted in
+ * batches once the readers that could still reach them have left their epoch.
+ *
+ * Writers are serialized by a mutex. Every method is safe to call from any thread, and the functor must not access the
+ * tree itself.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class rcu_tree {
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	rcu_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree, retiring all the nodes.
+	 */
+	void clear();
+
+	/**
+	 * @brief Destructor for the tree, which must not run concurrently with any other call.
+	 */
+	~rcu_tree();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The amount of retired nodes that triggers their reclamation.
+	 */
+	static constexpr std::size_t _batch = 256;
+
+	/**
+	 * @brief The node of the tree, immutable once published.
+	 */
+	class node {
+	private:
+		std::pair<_tkey, _tkey> _range;
+		_tvalue _value;
+
+		const node* _left;
+		const node* _right;
+
+	public:
+		node(const std::pair<_tkey, _tkey>& range, const _tvalue& value, const node* l, const node* r)
+			: _range(range), _value(value), _left(l), _right(r) {}
+
+		node(const _tkey& index, const _tvalue& value)
+			: node(std::make_pair(index, index), value, nullptr, nullptr) {}
+
+		const _tvalue& value() const { return _value; }
+		std::pair<_tkey, _tkey> range() const { return _range; }
+
+		const node* left() const { return _left; }
+		const node* right() const { return _right; }
+	};
+
+	/**
+	 * @brief The root of the current version.
+	 */
+	std::atomic<const node*> _root;
+
+	/**
+	 * @brief The mutex serializing the writers.
+	 */
+	std::mutex _writer;
+
+	/**
+	 * @brief The nodes unlinked by the writes, waiting for the readers to leave.
+	 */
+	std::vector<const node*> _retired;
+
+	/**
+	 * @brief The epochs of the readers.
+	 */
+	mutable epoch _epoch;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to create the parent of two disjoint subtrees.
+	 * @param left The subtree of the lower keys.
+	 * @param right The subtree of the upper keys.
+	 * @param range The range of the parent.
+	 * @return The parent.
+	 */
+	const node* _join(const node* left, const node* right, const std::pair<_tkey, _tkey>& range) const;
+
+	/**
+	 * @brief Internal function to insert or aggregate a value at a given key into a copy of a subtree.
+	 * @param cur The root of the subtree.
+	 * @param index The key to insert the value.
+	 * @param value The value to insert.
+	 * @param combine Whether to aggregate the value to an existing one instead of replacing it.
+	 * @param replaced The nodes of the subtree replaced by the copy.
+	 * @return The root of the copy.
+	 */
+	const node* _insert(const node* cur, const _tkey& index, const _tvalue& value, bool combine,
+		std::vector<const node*>& replaced) const;
+
+	/**
+	 * @brief Internal function to erase a key from a copy of a subtree.
+	 * @param cur The root of the subtree.
+	 * @param index The key to erase.
+	 * @param replaced The nodes of the subtree replaced by the copy.
+	 * @return The root of the copy, which is the subtree itself if the key is absent.
+	 */
+	const node* _erase(const node* cur, const _tkey& index, std::vector<const node*>& replaced) const;
+
+	/**
+	 * @brief Internal function to aggregate the nodes covering a range of keys in a version into a result, in key order.
+	 *
+	 * Only the nodes found are aggregated, the first one replacing the result, as in tree.
+	 *
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @param result The aggregate value so far.
+	 * @param found Whether a node was aggregated so far.
+	 */
+	void _query(const node* cur, const std::pair<_tkey, _tkey>& segment, _tvalue& result, bool& found) const;
+
+	/**
+	 * @brief Internal function to publish a new root and retire the replaced nodes, reclaiming them by batches.
+	 * @param root The new root.
+	 * @param replaced The nodes unlinked from the version.
+	 */
+	void _publish(const node* root, std::vector<const node*>& replaced);
+
+	/**
+	 * @brief Internal function to collect every node of a subtree.
+	 * @param cur The root of the subtree.
+	 * @param nodes The collected nodes.
+	 */
+	void _collect(const node* cur, std::vector<const node*>& nodes) const;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+rcu_tree<_tvalue, _tindex, _functor>::rcu_tree() : _root(nullptr) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+rcu_tree<_tvalue, _tindex, _functor>::~rcu_tree() {
+	_collect(_root.load(std::memory_order_relaxed), _retired);
+	for(const node* cur : _retired) delete cur;
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void rcu_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<std::mutex> guard(_writer);
+	std::vector<const node*> replaced;
+
+	const node* root = _insert(_root.load(std::memory_order_relaxed), key<_tindex>::encode(index), value, false, replaced);
+	_publish(root, replaced);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void rcu_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<std::mutex> guard(_writer);
+	std::vector<const node*> replaced;
+
+	const node* root = _insert(_root.load(std::memory_order_relaxed), key<_tindex>::encode(index), value, true, replaced);
+	_publish(root, replaced);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void rcu_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	std::lock_guard<std::mutex> guard(_writer);
+	std::vector<const node*> replaced;
+
+	const node* root = _erase(_root.load(std::memory_order_relaxed), key<_tindex>::encode(index), replaced);
+	if(!replaced.empty()) _publish(root, replaced);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue rcu_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	_tvalue result = _tvalue();
+	bool found = false;
+
+	epoch::guard guard(_epoch);
+	_query(_root.load(std::memory_order_seq_cst), std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end)),
+		result, found);
+
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue rcu_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue rcu_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+	_tvalue result = _tvalue();
+	bool found = false;
+
+	epoch::guard guard(_epoch);
+	_query(_root.load(std::memory_order_seq_cst), std::make_pair(target, target), result, found);
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void rcu_tree<_tvalue, _tindex, _functor>::clear() {
+	std::lock_guard<std::mutex> guard(_writer);
+	std::vector<const node*> replaced;
+
+	_collect(_root.load(std::memory_order_relaxed), replaced);
+	_publish(nullptr, replaced);
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+const typename rcu_tree<_tvalue, _tindex, _functor>::node*
+rcu_tree<_tvalue, _tindex, _functor>::_join(const node* left, const node* right, const std::pair<_tkey, _tkey>& range) const {
+	return new node(range, _func(left->value(), right->value()), left, right);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+const typename rcu_tree<_tvalue, _tindex, _functor>::node*
+rcu_tree<_tvalue, _tindex, _functor>::_insert(const node* cur, const _tkey& index, const _tvalue& value, bool combine,
+	std::vector<const node*>& replaced) const {
+
+	if(cur == nullptr) return new node(index, value);
+
+	auto range = cur->range();
+
+	// Outside of the subtree, which is kept whole under a new parent as in tree
+	if(index < range.first || range.second < index) {
+		_tkey mask = bit::block(range.first, index);
+		std::pair<_tkey, _tkey> parent = std::make_pair(_tkey(index & ~mask), _tkey(index | mask));
+		const node* leaf = new node(index, value);
+
+		if(index < range.first) return _join(leaf, cur, parent);
+		return _join(cur, leaf, parent);
+	}
+
+	replaced.push_back(cur);
+
+	if(range.first == range.second)
+		return new node(index, combine ? _func(cur->value(), value) : value);
+
+	auto mid = range.first + (range.second - range.first) / 2;
+
+	if(index <= mid) return _join(_insert(cur->left(), index, value, combine, replaced), cur->right(), range);
+	return _join(cur->left(), _insert(cur->right(), index, value, combine, replaced), range);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+const typename rcu_tree<_tvalue, _tindex, _functor>::node*
+rcu_tree<_tvalue, _tindex, _functor>::_erase(const node* cur, const _tkey& index, std::vector<const node*>& replaced) const {
+	if(cur == nullptr) return nullptr;
+
+	auto range = cur->range();
+	if(index < range.first || range.second < index) return cur;
+
+	if(range.first == range.second) {
+		replaced.push_back(cur);
+		return nullptr;
+	}
+
+	auto mid = range.first + (range.second - range.first) / 2;
+	bool left = index <= mid;
+
+	const node* child = left ? cur->left() : cur->right();
+	const node* copy = _erase(child, index, replaced);
+	if(copy == child) return cur;
+
+	// The node goes away with the child, or is copied above the new one
+	replaced.push_back(cur);
+	const node* other = left ? cur->right() : cur->left();
+
+	if(copy == nullptr) return other;
+	return left ? _join(copy, other, range) : _join(other, copy, range);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void rcu_tree<_tvalue, _tindex, _functor>::_query(const node* cur, const std::pair<_tkey, _tkey>& segment, _tvalue& result,
+	bool& found) const {
+
+	if(cur == nullptr) return;
+
+	auto range = cur->range();
+
+	if(segment.first <= range.first && range.second <= segment.second) {
+		result = found ? _func(result, cur->value()) : cur->value();
+		found = true;
+		return;
+	}
+
+	if(segment.second < range.first || range.second < segment.first || range.first == range.second)
+		return;
+
+	auto mid = range.first + (range.second - range.first) / 2;
+
+	if(segment.first <= mid) _query(cur->left(), segment, result, found);
+	if(mid < segment.second) _query(cur->right(), segment, result, found);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void rcu_tree<_tvalue, _tindex, _functor>::_publish(const node* root, std::vector<const node*>& replaced) {
+	_root.store(root, std::memory_order_seq_cst);
+	_retired.insert(_retired.end(), replaced.begin(), replaced.end());
+
+	if(_retired.size() < _batch) return;
+
+	// Every reader still holding a retired node entered before the swap above
+	_epoch.synchronize();
+	for(const node* cur : _retired) delete cur;
+	_retired.clear();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void rcu_tree<_tvalue, _tindex, _functor>::_collect(const node* cur, std::vector<const node*>& nodes) const {
+	if(cur == nullptr) return;
+
+	nodes.push_back(cur);
+	_collect(cur->left(), nodes);
+	_collect(cur->right(), nodes);
+}
+
+}
+
+#endif
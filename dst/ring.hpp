@@ -0,0 +1,145 @@
+/**
+ * @file ring.hpp
+ * @brief Implementation of the bounded lock-free queue carrying requests between threads.
+ */
+
+#ifndef DST_RING_HPP_
+#define DST_RING_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace dst {
+
+/**
+ * @brief A bounded queue for many producers and a single consumer, without locks.
+ *
+ * Every cell carries a sequence number telling whose turn it is, as in the bounded queue of Dmitry Vyukov. A producer
+ * reserves the next position with a compare-and-swap on the tail and fills the cell, then hands it to the consumer by
+ * advancing its sequence, and the consumer hands it back once emptied. Producers only contend on the tail, and the consumer
+ * never writes a shared counter of the producers.
+ *
+ * @tparam _type The type of the elements, which must be movable and default constructible.
+ */
+template<typename _type>
+class ring {
+public:
+	/**
+	 * @brief Constructor for the queue.
+	 * @param capacity The amount of cells, rounded up to a power of 2.
+	 */
+	explicit ring(std::size_t capacity = 1024);
+
+	ring(const ring&) = delete;
+	ring& operator=(const ring&) = delete;
+
+	/**
+	 * @brief Push an element at the back of the queue, from any thread.
+	 * @param value The element, moved into the queue on success.
+	 * @return Whether there was room for the element.
+	 */
+	bool push(_type& value);
+
+	/**
+	 * @brief Pop the element at the front of the queue, from the consumer thread only.
+	 * @param value The element, moved out of the queue on success.
+	 * @return Whether there was an element.
+	 */
+	bool pop(_type& value);
+
+private:
+	/**
+	 * @brief A cell of the queue.
+	 */
+	struct cell {
+		std::atomic<std::size_t> sequence;
+		_type value;
+	};
+
+	/**
+	 * @brief The cells.
+	 */
+	std::vector<cell> _cells;
+
+	/**
+	 * @brief The amount of cells minus one, masking the positions.
+	 */
+	std::size_t _mask;
+
+	/**
+	 * @brief The next position to push to.
+	 */
+	std::atomic<std::size_t> _tail;
+
+	/**
+	 * @brief Keeps the positions of the producers and of the consumer on separate cache lines.
+	 */
+	char _padding[64];
+
+	/**
+	 * @brief The next position to pop from.
+	 */
+	std::size_t _head;
+
+	/**
+	 * @brief Internal function to round a capacity up to a power of 2.
+	 */
+	static std::size_t _round(std::size_t capacity) {
+		std::size_t size = 2;
+		while(size < capacity) size <<= 1;
+		return size;
+	}
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _type>
+ring<_type>::ring(std::size_t capacity) : _cells(_round(capacity)), _mask(_cells.size() - 1), _tail(0), _head(0) {
+	for(std::size_t position = 0; position < _cells.size(); ++position)
+		_cells[position].sequence.store(position, std::memory_order_relaxed);
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _type>
+bool ring<_type>::push(_type& value) {
+	std::size_t position = _tail.load(std::memory_order_relaxed);
+	cell* cur;
+
+	while(true) {
+		cur = &_cells[position & _mask];
+		std::ptrdiff_t lag = std::ptrdiff_t(cur->sequence.load(std::memory_order_acquire) - position);
+
+		if(lag == 0) { // Free for this turn, try to take it
+			if(_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+		}
+		else if(lag < 0) return false; // Still held by the previous turn, the queue is full
+		else position = _tail.load(std::memory_order_relaxed);
+	}
+
+	cur->value = std::move(value);
+	cur->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename _type>
+bool ring<_type>::pop(_type& value) {
+	cell& cur = _cells[_head & _mask];
+	if(cur.sequence.load(std::memory_order_acquire) != _head + 1) return false;
+
+	value = std::move(cur.value);
+	cur.value = _type();
+	cur.sequence.store(_head + _mask + 1, std::memory_order_release);
+	++_head;
+	return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * @file rw_lock.hpp
+ * @brief Implementation of the read-optimized reader/writer lock shared by the concurrent structures.
+ */
+
+#ifndef DST_RW_LOCK_HPP_
+#define DST_RW_LOCK_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+namespace dst {
+
+/**
+ * @brief A reader/writer lock whose readers never share a counter, in the manner of a big-reader lock.
+ *
+ * Every thread is given one of 64 reader counters, each on its own cache line, so that readers running on different cores
+ * do not bounce a shared line between them. A reader announces itself on its counter and backs off while a writer holds
+ * the lock, and a writer raises its flag then waits for every counter to drain. Reading is thus two uncontended atomic
+ * operations, and writing costs a scan of the counters, which suits read-mostly workloads. Writers are preferred, and the
+ * lock is not recursive.
+ *
+ * The lock meets the requirements of Lockable for the writers, and provides lock_shared and unlock_shared for the readers.
+ */
+class rw_lock {
+public:
+	/**
+	 * @brief Constructor for the lock.
+	 */
+	rw_lock() : _writer(false) {
+		for(counter& cur : _readers) cur.value.store(0, std::memory_order_relaxed);
+	}
+
+	rw_lock(const rw_lock&) = delete;
+	rw_lock& operator=(const rw_lock&) = delete;
+
+	/**
+	 * @brief Acquire the lock exclusively, for a writer.
+	 */
+	void lock() {
+		while(_writer.exchange(true, std::memory_order_seq_cst)) std::this_thread::yield();
+
+		for(counter& cur : _readers)
+			while(cur.value.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+	}
+
+	/**
+	 * @brief Try to acquire the lock exclusively without waiting for another writer.
+	 * @return Whether the lock was acquired.
+	 */
+	bool try_lock() {
+		if(_writer.exchange(true, std::memory_order_seq_cst)) return false;
+
+		for(counter& cur : _readers)
+			while(cur.value.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+
+		return true;
+	}
+
+	/**
+	 * @brief Release the exclusive lock.
+	 */
+	void unlock() {
+		_writer.store(false, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Acquire the lock for a reader.
+	 */
+	void lock_shared() {
+		std::atomic<std::size_t>& mine = _readers[_slot()].value;
+
+		while(true) {
+			mine.fetch_add(1, std::memory_order_seq_cst);
+			if(!_writer.load(std::memory_order_seq_cst)) return;
+
+			// Step back so that the writer can drain the counters
+			mine.fetch_sub(1, std::memory_order_release);
+			while(_writer.load(std::memory_order_relaxed)) std::this_thread::yield();
+		}
+	}
+
+	/**
+	 * @brief Release the lock held by a reader.
+	 */
+	void unlock_shared() {
+		_readers[_slot()].value.fetch_sub(1, std::memory_order_release);
+	}
+
+private:
+	/**
+	 * @brief The amount of reader counters.
+	 */
+	static constexpr std::size_t _slots = 64;
+
+	/**
+	 * @brief A reader counter padded to a cache line, so that no two counters ever share one. Padding rather than alignment
+	 * keeps the lock allocatable by a plain new before C++17.
+	 */
+	struct counter {
+		std::atomic<std::size_t> value;
+		char padding[64 - sizeof(std::atomic<std::size_t>)];
+	};
+
+	/**
+	 * @brief The reader counters.
+	 */
+	counter _readers[_slots];
+
+	/**
+	 * @brief Keeps the writer flag off the cache line of the last counter.
+	 */
+	char _padding[64];
+
+	/**
+	 * @brief Whether a writer holds or is acquiring the lock.
+	 */
+	std::atomic<bool> _writer;
+
+	/**
+	 * @brief Internal function to give the counter of the calling thread, assigned in turn on its first call.
+	 */
+	static std::size_t _slot() {
+		static std::atomic<std::size_t> next(0);
+		thread_local std::size_t slot = next.fetch_add(1, std::memory_order_relaxed) % _slots;
+		return slot;
+	}
+};
+
+/**
+ * @brief Scoped reader ownership of a lock, the shared counterpart of std::lock_guard.
+ * @tparam _lock The type of the lock, providing lock_shared and unlock_shared.
+ */
+template<class _lock>
+class shared_guard {
+public:
+	explicit shared_guard(_lock& owner) : _owner(owner) { _owner.lock_shared(); }
+	~shared_guard() { _owner.unlock_shared(); }
+
+	shared_guard(const shared_guard&) = delete;
+	shared_guard& operator=(const shared_guard&) = delete;
+
+private:
+	_lock& _owner;
+};
+
+}
+
+#endif
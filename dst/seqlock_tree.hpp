@@ -0,0 +1,502 @@
+/**
+ * @file seqlock_tree.hpp
+ * @brief Implementation of the dynamic segment tree read optimistically under a sequence lock.
+ */
+
+#ifndef DST_SEQLOCK_TREE_HPP_
+#define DST_SEQLOCK_TREE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bit.hpp"
+#include "key.hpp"
+
+namespace dst {
+
+/**
+ * @brief The sequence lock tree, whose readers write no shared memory at all.
+ *
+ * A writer makes a sequence counter odd, modifies the nodes in place, and makes it even again. A reader runs the query
+ * without any lock, and keeps the result only if the counter was even and unchanged from before to after the traversal,
+ * retrying otherwise. Readers thus never bounce a cache line between cores, which suits small trees read very often and
+ * written rarely. After a few failed attempts in a row, a reader takes the writer mutex instead, so that a steady flow of
+ * writes cannot starve it.
+ *
+ * A traversal running during a write may see a mix of versions. Every field of the nodes is therefore held in a std::atomic,
+ * the links being stored with release so that a new node is seen initialized, and erased nodes are kept in a free list for
+ * reuse instead of being deleted, so that any pointer read leads to a node. The amount of nodes a traversal visits is
+ * bounded as well, since the links may momentarily form a longer path than any version has. The values must thus be
+ * trivially copyable, and the functor must accept values of different versions, whose result is discarded. Types wider
+ * than a machine word may require linking libatomic.
+ *
+ * Writers are serialized by a mutex. Every method is safe to call from any thread, and the functor must not access the
+ * tree itself.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class seqlock_tree {
+	static_assert(std::is_trivially_copyable<_tvalue>::value, "The value type must be trivially copyable");
+
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	seqlock_tree();
+
+	seqlock_tree(const seqlock_tree&) = delete;
+	seqlock_tree& operator=(const seqlock_tree&) = delete;
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree, keeping its nodes for reuse.
+	 */
+	void clear();
+
+	/**
+	 * @brief Destructor for the tree.
+	 */
+	~seqlock_tree();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The amount of optimistic attempts of a reader before it locks.
+	 */
+	static constexpr unsigned _attempts = 16;
+
+	/**
+	 * @brief The amount of levels of a tree, bounding the paths of a traversal.
+	 */
+	static constexpr std::size_t _depth = (sizeof(_tkey) << 3) + 1;
+
+	/**
+	 * @brief A node of the tree, which may be read at any time during a write.
+	 */
+	struct node {
+		std::atomic<_tkey> first;
+		std::atomic<_tkey> last;
+		std::atomic<_tvalue> value;
+
+		std::atomic<node*> left;
+		std::atomic<node*> right;
+	};
+
+	/**
+	 * @brief The root of the tree.
+	 */
+	std::atomic<node*> _root;
+
+	/**
+	 * @brief The sequence counter, odd while a write is in progress.
+	 */
+	std::atomic<std::size_t> _sequence;
+
+	/**
+	 * @brief The mutex serializing the writers, also taken by the readers failing too often.
+	 */
+	mutable std::mutex _writer;
+
+	/**
+	 * @brief The nodes removed from the tree, kept for reuse until the tree is destroyed.
+	 */
+	std::vector<node*> _free;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to open a write, with the writer mutex held.
+	 */
+	void _open();
+
+	/**
+	 * @brief Internal function to close a write, with the writer mutex held.
+	 */
+	void _close();
+
+	/**
+	 * @brief Internal function to give a node from the free list, or a new one.
+	 * @param range The range of the node.
+	 * @param value The value of the node.
+	 * @param l The left child.
+	 * @param r The right child.
+	 * @return The node.
+	 */
+	node* _make(const std::pair<_tkey, _tkey>& range, const _tvalue& value, node* l, node* r);
+
+	/**
+	 * @brief Internal function to insert or aggregate a value at a given key in a subtree, during a write.
+	 * @param cur The root of the subtree.
+	 * @param index The key to insert the value.
+	 * @param value The value to insert.
+	 * @param combine Whether to aggregate the value to an existing one instead of replacing it.
+	 * @return The new root of the subtree.
+	 */
+	node* _insert(node* cur, const _tkey& index, const _tvalue& value, bool combine);
+
+	/**
+	 * @brief Internal function to erase a key present in a subtree, during a write.
+	 * @param cur The root of the subtree.
+	 * @param index The key to erase.
+	 * @return The new root of the subtree.
+	 */
+	node* _erase(node* cur, const _tkey& index);
+
+	/**
+	 * @brief Internal function to find the leaf of a key, at most _depth nodes down.
+	 * @param index The key to find.
+	 * @return The leaf, or null if the key is absent.
+	 */
+	const node* _find(const _tkey& index) const;
+
+	/**
+	 * @brief Internal function to aggregate the nodes covering a range of keys into a result, visiting a bounded amount of
+	 * nodes.
+	 *
+	 * Only the nodes found are aggregated, the first one replacing the result, as in tree.
+	 *
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @param budget The amount of nodes the traversal may still visit, zero once exhausted.
+	 * @param result The aggregate value so far.
+	 * @param found Whether a node was aggregated so far.
+	 */
+	void _query(const node* cur, const std::pair<_tkey, _tkey>& segment, std::size_t& budget, _tvalue& result,
+		bool& found) const;
+
+	/**
+	 * @brief Internal function to move a subtree to the free list.
+	 * @param cur The current node.
+	 */
+	void _recycle(node* cur);
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+seqlock_tree<_tvalue, _tindex, _functor>::seqlock_tree() : _root(nullptr), _sequence(0) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+seqlock_tree<_tvalue, _tindex, _functor>::~seqlock_tree() {
+	_recycle(_root.load(std::memory_order_relaxed));
+	for(node* cur : _free) delete cur;
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void seqlock_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<std::mutex> guard(_writer);
+
+	_open();
+	_root.store(_insert(_root.load(std::memory_order_relaxed), key<_tindex>::encode(index), value, false), std::memory_order_release);
+	_close();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void seqlock_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	std::lock_guard<std::mutex> guard(_writer);
+
+	_open();
+	_root.store(_insert(_root.load(std::memory_order_relaxed), key<_tindex>::encode(index), value, true), std::memory_order_release);
+	_close();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void seqlock_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	_tkey target = key<_tindex>::encode(index);
+	std::lock_guard<std::mutex> guard(_writer);
+
+	// Checked first, so that erasing an absent key does not disturb the readers
+	if(_find(target) == nullptr) return;
+
+	_open();
+	_root.store(_erase(_root.load(std::memory_order_relaxed), target), std::memory_order_release);
+	_close();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue seqlock_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	std::pair<_tkey, _tkey> segment = std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end));
+
+	for(unsigned attempt = 0; attempt < _attempts; ++attempt) {
+		std::size_t before = _sequence.load(std::memory_order_acquire);
+
+		if(before & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		// A query of a consistent version visits at most four nodes per level
+		std::size_t budget = 4 * (_depth + 1);
+		_tvalue result = _tvalue();
+		bool found = false;
+
+		_query(_root.load(std::memory_order_acquire), segment, budget, result, found);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(budget > 0 && _sequence.load(std::memory_order_relaxed) == before) return result;
+	}
+
+	std::lock_guard<std::mutex> guard(_writer);
+	std::size_t budget = 4 * (_depth + 1);
+	_tvalue result = _tvalue();
+	bool found = false;
+
+	_query(_root.load(std::memory_order_acquire), segment, budget, result, found);
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue seqlock_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue seqlock_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+
+	for(unsigned attempt = 0; attempt < _attempts; ++attempt) {
+		std::size_t before = _sequence.load(std::memory_order_acquire);
+
+		if(before & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		const node* leaf = _find(target);
+		_tvalue result = leaf == nullptr ? _tvalue() : leaf->value.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(_sequence.load(std::memory_order_relaxed) == before) return result;
+	}
+
+	std::lock_guard<std::mutex> guard(_writer);
+	const node* leaf = _find(target);
+	return leaf == nullptr ? _tvalue() : leaf->value.load(std::memory_order_relaxed);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void seqlock_tree<_tvalue, _tindex, _functor>::clear() {
+	std::lock_guard<std::mutex> guard(_writer);
+
+	_open();
+	_recycle(_root.load(std::memory_order_relaxed));
+	_root.store(nullptr, std::memory_order_relaxed);
+	_close();
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void seqlock_tree<_tvalue, _tindex, _functor>::_open() {
+	_sequence.store(_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void seqlock_tree<_tvalue, _tindex, _functor>::_close() {
+	_sequence.store(_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename seqlock_tree<_tvalue, _tindex, _functor>::node*
+seqlock_tree<_tvalue, _tindex, _functor>::_make(const std::pair<_tkey, _tkey>& range, const _tvalue& value, node* l, node* r) {
+	node* cur;
+
+	if(_free.empty()) cur = new node();
+	else {
+		cur = _free.back();
+		_free.pop_back();
+	}
+
+	cur->first.store(range.first, std::memory_order_relaxed);
+	cur->last.store(range.second, std::memory_order_relaxed);
+	cur->value.store(value, std::memory_order_relaxed);
+	cur->left.store(l, std::memory_order_relaxed);
+	cur->right.store(r, std::memory_order_relaxed);
+	return cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename seqlock_tree<_tvalue, _tindex, _functor>::node*
+seqlock_tree<_tvalue, _tindex, _functor>::_insert(node* cur, const _tkey& index, const _tvalue& value, bool combine) {
+	if(cur == nullptr) return _make(std::make_pair(index, index), value, nullptr, nullptr);
+
+	_tkey first = cur->first.load(std::memory_order_relaxed), last = cur->last.load(std::memory_order_relaxed);
+	_tvalue total = cur->value.load(std::memory_order_relaxed);
+
+	// Outside of the subtree, which goes under a new parent as in tree
+	if(index < first || last < index) {
+		_tkey mask = bit::block(first, index);
+		std::pair<_tkey, _tkey> parent = std::make_pair(_tkey(index & ~mask), _tkey(index | mask));
+		node* leaf = _make(std::make_pair(index, index), value, nullptr, nullptr);
+
+		if(index < first) return _make(parent, _func(value, total), leaf, cur);
+		return _make(parent, _func(total, value), cur, leaf);
+	}
+
+	if(first == last) {
+		cur->value.store(combine ? _func(total, value) : value, std::memory_order_relaxed);
+		return cur;
+	}
+
+	auto mid = first + (last - first) / 2;
+	node* l = cur->left.load(std::memory_order_relaxed);
+	node* r = cur->right.load(std::memory_order_relaxed);
+
+	if(index <= mid) cur->left.store(l = _insert(l, index, value, combine), std::memory_order_release);
+	else cur->right.store(r = _insert(r, index, value, combine), std::memory_order_release);
+
+	cur->value.store(_func(l->value.load(std::memory_order_relaxed), r->value.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+	return cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename seqlock_tree<_tvalue, _tindex, _functor>::node*
+seqlock_tree<_tvalue, _tindex, _functor>::_erase(node* cur, const _tkey& index) {
+	_tkey first = cur->first.load(std::memory_order_relaxed), last = cur->last.load(std::memory_order_relaxed);
+
+	if(first == last) {
+		_free.push_back(cur);
+		return nullptr;
+	}
+
+	auto mid = first + (last - first) / 2;
+	std::atomic<node*>& child = index <= mid ? cur->left : cur->right;
+	std::atomic<node*>& other = index <= mid ? cur->right : cur->left;
+
+	node* rest = _erase(child.load(std::memory_order_relaxed), index);
+
+	// A node left with one child is replaced by it
+	if(rest == nullptr) {
+		_free.push_back(cur);
+		return other.load(std::memory_order_relaxed);
+	}
+
+	child.store(rest, std::memory_order_release);
+
+	node* l = cur->left.load(std::memory_order_relaxed);
+	node* r = cur->right.load(std::memory_order_relaxed);
+	cur->value.store(_func(l->value.load(std::memory_order_relaxed), r->value.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+	return cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+const typename seqlock_tree<_tvalue, _tindex, _functor>::node* seqlock_tree<_tvalue, _tindex, _functor>::_find(const _tkey& index) const {
+	const node* cur = _root.load(std::memory_order_acquire);
+
+	for(std::size_t level = 0; level < _depth && cur != nullptr; ++level) {
+		_tkey first = cur->first.load(std::memory_order_relaxed), last = cur->last.load(std::memory_order_relaxed);
+		if(index < first || last < index) return nullptr;
+		if(first == last) return cur;
+
+		auto mid = first + (last - first) / 2;
+		cur = (index <= mid ? cur->left : cur->right).load(std::memory_order_acquire);
+	}
+
+	return nullptr;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void seqlock_tree<_tvalue, _tindex, _functor>::_query(const node* cur, const std::pair<_tkey, _tkey>& segment,
+	std::size_t& budget, _tvalue& result, bool& found) const {
+
+	if(cur == nullptr || budget == 0) return;
+	--budget;
+
+	_tkey first = cur->first.load(std::memory_order_relaxed), last = cur->last.load(std::memory_order_relaxed);
+
+	if(segment.first <= first && last <= segment.second) {
+		_tvalue value = cur->value.load(std::memory_order_relaxed);
+		result = found ? _func(result, value) : value;
+		found = true;
+		return;
+	}
+
+	if(segment.second < first || last < segment.first || first == last)
+		return;
+
+	auto mid = first + (last - first) / 2;
+	const node* l = cur->left.load(std::memory_order_acquire);
+	const node* r = cur->right.load(std::memory_order_acquire);
+
+	if(segment.first <= mid) _query(l, segment, budget, result, found);
+	if(mid < segment.second) _query(r, segment, budget, result, found);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void seqlock_tree<_tvalue, _tindex, _functor>::_recycle(node* cur) {
+	if(cur == nullptr) return;
+
+	_recycle(cur->left.load(std::memory_order_relaxed));
+	_recycle(cur->right.load(std::memory_order_relaxed));
+	_free.push_back(cur);
+}
+
+}
+
+#endif
@@ -0,0 +1,272 @@
+/**
+ * @file series_tree.hpp
+ * @brief Implementation of the append-only segment tree for monotonic indices such as timestamps.
+ */
+
+#ifndef DST_SERIES_TREE_HPP_
+#define DST_SERIES_TREE_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "key.hpp"
+#include "packed_keys.hpp"
+
+namespace dst {
+
+/**
+ * @brief The append-only segment tree, for indices arriving in increasing order.
+ *
+ * This class stores its entries in arrival order, which is also the index order, and aggregates them by aligned blocks of
+ * positions. Level j holds the aggregate of every block of 2^j entries that has been fully written, so an append only seals
+ * the blocks it completes (one on average, so amortized O(1)) and never walks down from a root. A sealed block never
+ * changes again unless one of its entries is updated in place. Range queries locate their endpoints by binary search and
+ * combine at most two sealed blocks per level, in index order.
+ *
+ * The keys are kept delta-compressed by packed_keys, since the indices of a series are close to one another.
+ *
+ * The entries already written can be updated, and an index past the last one is appended, but an index falling between
+ * existing ones is rejected.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class series_tree {
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	series_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree, either past the last index or at an existing one.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 * @return Whether the value was inserted, which fails for new indices below the last one.
+	 */
+	bool insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree, either past the last index or at an existing one.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 * @return Whether the value was applied, which fails for new indices below the last one.
+	 */
+	bool apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief The amount of indices in the tree.
+	 */
+	std::size_t size() const;
+
+	/**
+	 * @brief Clear the tree by releasing every block.
+	 */
+	void clear();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The keys of the entries, in increasing order and delta-compressed.
+	 */
+	packed_keys<_tkey> _keys;
+
+	/**
+	 * @brief The aggregates of the sealed blocks, level j holding the blocks of 2^j entries and level 0 the values.
+	 */
+	std::vector<std::vector<_tvalue>> _levels;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to insert or aggregate a value at a given key.
+	 * @param index The key to insert the value.
+	 * @param value The value to insert.
+	 * @param combine Whether to aggregate the value to an existing one instead of replacing it.
+	 * @return Whether the key was past the last one or already present.
+	 */
+	bool _insert(const _tkey& index, const _tvalue& value, bool combine);
+
+	/**
+	 * @brief Internal function to append an entry, sealing the blocks it completes.
+	 * @param index The key of the entry.
+	 * @param value The value of the entry.
+	 */
+	void _append(const _tkey& index, const _tvalue& value);
+
+	/**
+	 * @brief Internal function to change the value at a position and refresh the sealed blocks holding it.
+	 * @param position The position of the entry.
+	 * @param value The new value.
+	 */
+	void _update(std::size_t position, const _tvalue& value);
+
+	/**
+	 * @brief Internal function to aggregate a half-open range of positions from the sealed blocks.
+	 * @param start The first position of the range.
+	 * @param end The position past the range.
+	 * @return The aggregate value of the range, the default value if it is empty.
+	 */
+	_tvalue _query(std::size_t start, std::size_t end) const;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+series_tree<_tvalue, _tindex, _functor>::series_tree() : _levels(1) {}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool series_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	return _insert(key<_tindex>::encode(index), value, false);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool series_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	return _insert(key<_tindex>::encode(index), value, true);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue series_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	_tkey first = key<_tindex>::encode(start), last = key<_tindex>::encode(end);
+	if(last < first) return _tvalue();
+
+	return _query(_keys.lower_bound(first), _keys.upper_bound(last));
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue series_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue series_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+	std::size_t position = _keys.lower_bound(target);
+
+	if(position == _keys.size() || _keys[position] != target) return _tvalue();
+	return _levels[0][position];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t series_tree<_tvalue, _tindex, _functor>::size() const {
+	return _keys.size();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void series_tree<_tvalue, _tindex, _functor>::clear() {
+	_keys.clear();
+	std::vector<std::vector<_tvalue>>(1).swap(_levels);
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool series_tree<_tvalue, _tindex, _functor>::_insert(const _tkey& index, const _tvalue& value, bool combine) {
+	if(_keys.empty() || _keys.back() < index) { // The common case, on the right edge
+		_append(index, value);
+		return true;
+	}
+
+	std::size_t position = _keys.lower_bound(index);
+	if(_keys[position] != index) return false; // Would go between existing entries
+
+	_update(position, combine ? _func(_levels[0][position], value) : value);
+	return true;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void series_tree<_tvalue, _tindex, _functor>::_append(const _tkey& index, const _tvalue& value) {
+	_keys.push_back(index);
+	_levels[0].push_back(value);
+
+	// Seal every block completed by the new entry, each level pairing the last two blocks of the one below
+	for(std::size_t level = 0; !(_levels[level].size() & 1); ++level) {
+		if(level + 1 == _levels.size()) _levels.emplace_back();
+
+		const std::vector<_tvalue>& below = _levels[level];
+		_levels[level + 1].push_back(_func(below[below.size() - 2], below.back()));
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void series_tree<_tvalue, _tindex, _functor>::_update(std::size_t position, const _tvalue& value) {
+	_levels[0][position] = value;
+
+	for(std::size_t level = 1; level < _levels.size(); ++level) {
+		position >>= 1;
+		if(position >= _levels[level].size()) break; // Not sealed yet
+
+		const std::vector<_tvalue>& below = _levels[level - 1];
+		_levels[level][position] = _func(below[position << 1], below[position << 1 | 1]);
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue series_tree<_tvalue, _tindex, _functor>::_query(std::size_t start, std::size_t end) const {
+	// Bottom-up over the sealed blocks, the right accumulator collecting in reverse to keep the order, each starting with
+	// the first block it meets so that the functor never sees a default value
+	_tvalue left = _tvalue(), right = _tvalue();
+	bool lhs = false, rhs = false;
+
+	for(std::size_t level = 0; start < end; ++level, start >>= 1, end >>= 1) {
+		if(start & 1) {
+			left = lhs ? _func(left, _levels[level][start]) : _levels[level][start];
+			lhs = true;
+			++start;
+		}
+
+		if(end & 1) {
+			--end;
+			right = rhs ? _func(_levels[level][end], right) : _levels[level][end];
+			rhs = true;
+		}
+	}
+
+	if(lhs && rhs) return _func(left, right);
+	return lhs ? left : right;
+}
+
+}
+
+#endif
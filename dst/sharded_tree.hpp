@@ -0,0 +1,315 @@
+/**
+ * @file sharded_tree.hpp
+ * @brief Implementation of the dynamic segment tree partitioned into independently locked ranges of keys.
+ */
+
+#ifndef DST_SHARDED_TREE_HPP_
+#define DST_SHARDED_TREE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "key.hpp"
+#include "rw_lock.hpp"
+#include "thread_pool.hpp"
+#include "tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The sharded tree, which splits the keys into contiguous ranges, each held by its own tree and lock.
+ *
+ * Every shard is a tree guarded by a rw_lock, so writes to different shards run fully in parallel and never meet at a
+ * common root. A range query only visits the shards it overlaps and combines their aggregates in key order, fanning out
+ * to the thread pool when it spans enough shards to be worth it, and only the shards holding an index of the range are
+ * aggregated. A query reads each shard under its own lock, so it is consistent per shard but not across them. If the
+ * functor throws during a parallel query, the exception is rethrown once every task is over.
+ *
+ * By default the keys are split evenly, which suits indices spread over their whole type. Clustered indices should rather
+ * be given explicit split points.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class sharded_tree {
+public:
+	/**
+	 * @brief Constructor for the tree, splitting the keys evenly.
+	 * @param shards The amount of shards.
+	 * @param pool The thread pool running the parallel queries. Default to the shared pool.
+	 */
+	explicit sharded_tree(std::size_t shards = 16, thread_pool& pool = thread_pool::shared());
+
+	/**
+	 * @brief Constructor for the tree, splitting the keys at given indices.
+	 * @param splits The first index of every shard but the first one, in increasing order.
+	 * @param pool The thread pool running the parallel queries. Default to the shared pool.
+	 */
+	explicit sharded_tree(const std::vector<_tindex>& splits, thread_pool& pool = thread_pool::shared());
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Clear the tree, one shard at a time.
+	 */
+	void clear();
+
+	/**
+	 * @brief The amount of shards.
+	 */
+	std::size_t shards() const;
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The least amount of shards a query must span to be run in parallel.
+	 */
+	static constexpr std::size_t _fanout = 4;
+
+	/**
+	 * @brief A shard, a tree with its lock.
+	 */
+	struct shard {
+		tree<_tvalue, _tindex, _functor> values;
+		mutable rw_lock lock;
+	};
+
+	/**
+	 * @brief The first key of every shard but the first one.
+	 */
+	std::vector<_tkey> _splits;
+
+	/**
+	 * @brief The shards, in key order.
+	 */
+	std::vector<std::unique_ptr<shard>> _shards;
+
+	/**
+	 * @brief The thread pool running the parallel queries.
+	 */
+	thread_pool& _pool;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to find the shard holding a key.
+	 * @param index The key.
+	 * @return The position of the shard.
+	 */
+	std::size_t _find(const _tkey& index) const;
+
+	/**
+	 * @brief Internal function to query a range in one shard under its lock.
+	 * @param position The position of the shard.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @param result The aggregate value of the range in the shard, left unchanged if there is none.
+	 * @return Whether an index of the range exists in the shard.
+	 */
+	bool _query(std::size_t position, const _tindex& start, const _tindex& end, _tvalue& result) const;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+sharded_tree<_tvalue, _tindex, _functor>::sharded_tree(std::size_t shards, thread_pool& pool) : _pool(pool) {
+	if(shards == 0) shards = 1;
+
+	_tkey step = _tkey(_tkey(~_tkey(0)) / shards);
+	for(std::size_t i = 1; i < shards; ++i) _splits.push_back(_tkey(step * i + i));
+
+	for(std::size_t i = 0; i < shards; ++i) _shards.emplace_back(new shard());
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+sharded_tree<_tvalue, _tindex, _functor>::sharded_tree(const std::vector<_tindex>& splits, thread_pool& pool) : _pool(pool) {
+	for(const _tindex& index : splits) _splits.push_back(key<_tindex>::encode(index));
+	for(std::size_t i = 0; i <= _splits.size(); ++i) _shards.emplace_back(new shard());
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void sharded_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	shard& cur = *_shards[_find(key<_tindex>::encode(index))];
+	std::lock_guard<rw_lock> guard(cur.lock);
+	cur.values.insert(index, value);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void sharded_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	shard& cur = *_shards[_find(key<_tindex>::encode(index))];
+	std::lock_guard<rw_lock> guard(cur.lock);
+	cur.values.apply(index, value);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void sharded_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	shard& cur = *_shards[_find(key<_tindex>::encode(index))];
+	std::lock_guard<rw_lock> guard(cur.lock);
+	cur.values.erase(index);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue sharded_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	_tkey first = key<_tindex>::encode(start), last = key<_tindex>::encode(end);
+	if(last < first) return _tvalue();
+
+	std::size_t low = _find(first), high = _find(last);
+	_tvalue result = _tvalue(), value = _tvalue();
+	bool found = false;
+
+	if(high - low + 1 < _fanout) {
+		for(std::size_t position = low; position <= high; ++position) {
+			if(!_query(position, start, end, value)) continue;
+
+			result = found ? _func(result, value) : value;
+			found = true;
+		}
+
+		return result;
+	}
+
+	// The first shard is queried by the calling thread while the others run on the pool
+	std::vector<std::future<std::pair<bool, _tvalue>>> parts;
+	std::exception_ptr error;
+
+	try {
+		for(std::size_t position = low + 1; position <= high; ++position) {
+			parts.push_back(_pool.submit([this, position, start, end] {
+				std::pair<bool, _tvalue> part(false, _tvalue());
+				part.first = _query(position, start, end, part.second);
+				return part;
+			}));
+		}
+
+		found = _query(low, start, end, result);
+	}
+	catch(...) {
+		error = std::current_exception();
+	}
+
+	// Every part is waited for before rethrowing, since they refer to the tree
+	for(std::future<std::pair<bool, _tvalue>>& part : parts) {
+		try {
+			std::pair<bool, _tvalue> shard = _pool.wait(part);
+			if(error || !shard.first) continue;
+
+			result = found ? _func(result, shard.second) : shard.second;
+			found = true;
+		}
+		catch(...) {
+			if(!error) error = std::current_exception();
+		}
+	}
+
+	if(error) std::rethrow_exception(error);
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue sharded_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue sharded_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	const shard& cur = *_shards[_find(key<_tindex>::encode(index))];
+	shared_guard<rw_lock> guard(cur.lock);
+	return cur.values[index];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void sharded_tree<_tvalue, _tindex, _functor>::clear() {
+	for(std::unique_ptr<shard>& cur : _shards) {
+		std::lock_guard<rw_lock> guard(cur->lock);
+		cur->values.clear();
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t sharded_tree<_tvalue, _tindex, _functor>::shards() const {
+	return _shards.size();
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t sharded_tree<_tvalue, _tindex, _functor>::_find(const _tkey& index) const {
+	return std::upper_bound(_splits.begin(), _splits.end(), index) - _splits.begin();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+bool sharded_tree<_tvalue, _tindex, _functor>::_query(std::size_t position, const _tindex& start, const _tindex& end,
+	_tvalue& result) const {
+
+	const shard& cur = *_shards[position];
+	shared_guard<rw_lock> guard(cur.lock);
+	return cur.values.query(start, end, result);
+}
+
+}
+
+#endif
@@ -0,0 +1,577 @@
+/**
+ * @file snapshot_tree.hpp
+ * @brief Implementation of the dynamic segment tree with constant-time copy-on-write snapshots.
+ */
+
+#ifndef DST_SNAPSHOT_TREE_HPP_
+#define DST_SNAPSHOT_TREE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+#include "bit.hpp"
+#include "key.hpp"
+
+namespace dst {
+
+/**
+ * @brief The snapshot tree, a tree of which immutable views are taken in constant time.
+ *
+ * This class has the interface of tree, its nodes holding their range as a pair of keys and a reference count instead of
+ * the parent link. A snapshot is a view holding a reference to the root, so that taking it copies nothing. A write modifies the nodes on its
+ * path in place as long as the tree is their only holder, and copies them otherwise, the copy sharing the untouched
+ * children. The nodes reachable from a view are thus never modified, and a view costs the memory of the paths written
+ * since it was taken. A node is deleted with the last view or tree holding it.
+ *
+ * Modifications and snapshot must not run concurrently with one another, as in tree, but views may be queried, copied and
+ * destroyed from any thread while the tree is written, which lets long readers work on a consistent version.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class snapshot_tree {
+public:
+	/**
+	 * @brief An immutable version of the tree, see snapshot.
+	 */
+	class view;
+
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	snapshot_tree();
+
+	snapshot_tree(const snapshot_tree&) = delete;
+	snapshot_tree& operator=(const snapshot_tree&) = delete;
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const _tindex& index);
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Take an immutable view of the current version of the tree, in constant time.
+	 * @return The view.
+	 */
+	view snapshot() const;
+
+	/**
+	 * @brief Bring the tree back to a view taken from it, in constant time, releasing its current nodes to the views still
+	 * holding them.
+	 * @param version The view.
+	 */
+	void restore(const view& version);
+
+	/**
+	 * @brief Clear the tree, releasing its nodes to the views still holding them.
+	 */
+	void clear();
+
+	/**
+	 * @brief Destructor for the tree.
+	 */
+	~snapshot_tree();
+
+private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
+	/**
+	 * @brief The node of the tree, shared by the tree and the views through its reference count.
+	 */
+	class node {
+	private:
+		std::pair<_tkey, _tkey> _range;
+		_tvalue _value;
+
+		node* _left;
+		node* _right;
+
+		std::atomic<std::size_t> _refs;
+
+	public:
+		node(const std::pair<_tkey, _tkey>& range, const _tvalue& value, node* l, node* r)
+			: _range(range), _value(value), _left(l), _right(r), _refs(1) {}
+
+		node(const _tkey& index, const _tvalue& value)
+			: node(std::make_pair(index, index), value, nullptr, nullptr) {}
+
+		_tvalue& value() { return _value; }
+		const _tvalue& value() const { return _value; }
+		std::pair<_tkey, _tkey> range() const { return _range; }
+
+		node*& left() { return _left; }
+		node*& right() { return _right; }
+
+		const node* left() const { return _left; }
+		const node* right() const { return _right; }
+
+		std::atomic<std::size_t>& refs() { return _refs; }
+	};
+
+	/**
+	 * @brief The root of the tree, of which the tree holds a reference.
+	 */
+	node* _root;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to take a reference to a node.
+	 * @param cur The node, possibly null.
+	 * @return The node.
+	 */
+	static node* _retain(node* cur);
+
+	/**
+	 * @brief Internal function to drop a reference to a node, deleting it with its own references if it was the last.
+	 * @param cur The node, possibly null.
+	 */
+	static void _release(node* cur);
+
+	/**
+	 * @brief Internal function to make a node writable, copying it if it is shared.
+	 *
+	 * The reference to a shared node is kept, and only released by the caller once its write succeeded, so that a write
+	 * throwing midway drops the copies and leaves the shared nodes as they were.
+	 *
+	 * @param cur The node.
+	 * @return The node itself if the reference is the only one, or a copy sharing its children.
+	 */
+	static node* _own(node* cur);
+
+	/**
+	 * @brief Internal function to insert or aggregate a value at a given key in a subtree.
+	 * @param cur The root of the subtree, whose reference is handed over if no exception is thrown.
+	 * @param index The key to insert the value.
+	 * @param value The value to insert.
+	 * @param combine Whether to aggregate the value to an existing one instead of replacing it.
+	 * @return The new root of the subtree.
+	 */
+	node* _insert(node* cur, const _tkey& index, const _tvalue& value, bool combine);
+
+	/**
+	 * @brief Internal function to erase a key present in a subtree.
+	 * @param cur The root of the subtree, whose reference is handed over if no exception is thrown.
+	 * @param index The key to erase.
+	 * @return The new root of the subtree.
+	 */
+	node* _erase(node* cur, const _tkey& index);
+
+	/**
+	 * @brief Internal function to find the leaf of a key.
+	 * @param cur The root of the subtree.
+	 * @param index The key to find.
+	 * @return The leaf, or null if the key is absent.
+	 */
+	static const node* _find(const node* cur, const _tkey& index);
+
+	/**
+	 * @brief Internal function to query the aggregate value of a range of keys in a version.
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @param func The functor aggregating the values.
+	 * @return The aggregate value of the range.
+	 */
+	static _tvalue _query(const node* cur, const std::pair<_tkey, _tkey>& segment, const _functor& func);
+
+	/**
+	 * @brief Internal function to aggregate the nodes covering a range of keys in a version into a result, in key order.
+	 *
+	 * Only the nodes found are aggregated, the first one replacing the result, as in tree.
+	 *
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @param func The functor aggregating the values.
+	 * @param result The aggregate value so far.
+	 * @param found Whether a node was aggregated so far.
+	 */
+	static void _query(const node* cur, const std::pair<_tkey, _tkey>& segment, const _functor& func, _tvalue& result,
+		bool& found);
+};
+
+template<typename _tvalue, typename _tindex, class _functor>
+class snapshot_tree<_tvalue, _tindex, _functor>::view {
+public:
+	/**
+	 * @brief Constructor for an empty view.
+	 */
+	view();
+
+	/**
+	 * @brief Copy constructor for the view, sharing its version.
+	 * @param other The view to copy.
+	 */
+	view(const view& other);
+
+	/**
+	 * @brief Copy assignment for the view, sharing the version of the other.
+	 * @param other The view to copy.
+	 * @return The view.
+	 */
+	view& operator=(const view& other);
+
+	/**
+	 * @brief Aggregate the values in the given range in the version of the view. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range in the version of the view. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Access the value at a given index in the version of the view.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Destructor for the view, releasing its version.
+	 */
+	~view();
+
+private:
+	friend class snapshot_tree;
+
+	/**
+	 * @brief Constructor for a view of a version.
+	 * @param root The root of the version, whose reference is handed over.
+	 * @param func The functor of the tree.
+	 */
+	view(node* root, const _functor& func);
+
+	/**
+	 * @brief The root of the version, of which the view holds a reference.
+	 */
+	node* _root;
+
+	/**
+	 * @brief Aggregation functor used by the view.
+	 */
+	_functor _func;
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+snapshot_tree<_tvalue, _tindex, _functor>::snapshot_tree() : _root(nullptr) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+snapshot_tree<_tvalue, _tindex, _functor>::~snapshot_tree() {
+	_release(_root);
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+void snapshot_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	_root = _insert(_root, key<_tindex>::encode(index), value, false);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void snapshot_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	_root = _insert(_root, key<_tindex>::encode(index), value, true);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void snapshot_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	_tkey target = key<_tindex>::encode(index);
+
+	// Checked first, so that erasing an absent key copies nothing
+	if(_find(_root, target) != nullptr) _root = _erase(_root, target);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue snapshot_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	return _query(_root, std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end)), _func);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue snapshot_tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue snapshot_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	const node* leaf = _find(_root, key<_tindex>::encode(index));
+	return leaf == nullptr ? _tvalue() : leaf->value();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename snapshot_tree<_tvalue, _tindex, _functor>::view snapshot_tree<_tvalue, _tindex, _functor>::snapshot() const {
+	return view(_retain(_root), _func);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void snapshot_tree<_tvalue, _tindex, _functor>::restore(const view& version) {
+	node* root = _retain(version._root);
+	_release(_root);
+	_root = root;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void snapshot_tree<_tvalue, _tindex, _functor>::clear() {
+	_release(_root);
+	_root = nullptr;
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename snapshot_tree<_tvalue, _tindex, _functor>::node* snapshot_tree<_tvalue, _tindex, _functor>::_retain(node* cur) {
+	if(cur != nullptr) cur->refs().fetch_add(1, std::memory_order_relaxed);
+	return cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void snapshot_tree<_tvalue, _tindex, _functor>::_release(node* cur) {
+	if(cur == nullptr || cur->refs().fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+	_release(cur->left());
+	_release(cur->right());
+	delete cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename snapshot_tree<_tvalue, _tindex, _functor>::node* snapshot_tree<_tvalue, _tindex, _functor>::_own(node* cur) {
+	// Acquire pairs with the release of the last view, whose reads of the node then happened before the writes
+	if(cur->refs().load(std::memory_order_acquire) == 1) return cur;
+
+	return new node(cur->range(), cur->value(), _retain(cur->left()), _retain(cur->right()));
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename snapshot_tree<_tvalue, _tindex, _functor>::node*
+snapshot_tree<_tvalue, _tindex, _functor>::_insert(node* cur, const _tkey& index, const _tvalue& value, bool combine) {
+	if(cur == nullptr) return new node(index, value);
+
+	auto range = cur->range();
+
+	// Outside of the subtree, which is kept whole under a new parent as in tree
+	if(index < range.first || range.second < index) {
+		_tkey mask = bit::block(range.first, index);
+		std::pair<_tkey, _tkey> parent = std::make_pair(_tkey(index & ~mask), _tkey(index | mask));
+		_tvalue total = (index < range.first) ? _func(value, cur->value()) : _func(cur->value(), value);
+		node* leaf = new node(index, value);
+
+		if(index < range.first) return new node(parent, total, leaf, cur);
+		return new node(parent, total, cur, leaf);
+	}
+
+	node* owned = _own(cur);
+
+	try {
+		if(range.first == range.second) owned->value() = combine ? _func(owned->value(), value) : value;
+		else {
+			auto mid = range.first + (range.second - range.first) / 2;
+
+			if(index <= mid) owned->left() = _insert(owned->left(), index, value, combine);
+			else owned->right() = _insert(owned->right(), index, value, combine);
+
+			owned->value() = _func(owned->left()->value(), owned->right()->value());
+		}
+	}
+	catch(...) {
+		if(owned != cur) _release(owned);
+		throw;
+	}
+
+	if(owned != cur) _release(cur);
+	return owned;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename snapshot_tree<_tvalue, _tindex, _functor>::node*
+snapshot_tree<_tvalue, _tindex, _functor>::_erase(node* cur, const _tkey& index) {
+	auto range = cur->range();
+
+	if(range.first == range.second) {
+		_release(cur);
+		return nullptr;
+	}
+
+	auto mid = range.first + (range.second - range.first) / 2;
+	node* owned = _own(cur);
+	node*& child = index <= mid ? owned->left() : owned->right();
+
+	try {
+		child = _erase(child, index);
+		if(child != nullptr) owned->value() = _func(owned->left()->value(), owned->right()->value());
+	}
+	catch(...) {
+		if(owned != cur) _release(owned);
+		throw;
+	}
+
+	if(owned != cur) _release(cur);
+
+	// A node left with one child is replaced by it, handing over its reference
+	if(child == nullptr) {
+		node*& other = index <= mid ? owned->right() : owned->left();
+		node* result = other;
+
+		other = nullptr;
+		_release(owned);
+		return result;
+	}
+
+	return owned;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+const typename snapshot_tree<_tvalue, _tindex, _functor>::node*
+snapshot_tree<_tvalue, _tindex, _functor>::_find(const node* cur, const _tkey& index) {
+	while(cur != nullptr) {
+		auto range = cur->range();
+		if(index < range.first || range.second < index) return nullptr;
+		if(range.first == range.second) return cur;
+
+		auto mid = range.first + (range.second - range.first) / 2;
+		cur = index <= mid ? cur->left() : cur->right();
+	}
+
+	return nullptr;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue snapshot_tree<_tvalue, _tindex, _functor>::_query(const node* cur, const std::pair<_tkey, _tkey>& segment,
+	const _functor& func) {
+
+	_tvalue result = _tvalue();
+	bool found = false;
+
+	_query(cur, segment, func, result, found);
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void snapshot_tree<_tvalue, _tindex, _functor>::_query(const node* cur, const std::pair<_tkey, _tkey>& segment,
+	const _functor& func, _tvalue& result, bool& found) {
+
+	if(cur == nullptr) return;
+
+	auto range = cur->range();
+
+	if(segment.first <= range.first && range.second <= segment.second) {
+		result = found ? func(result, cur->value()) : cur->value();
+		found = true;
+		return;
+	}
+
+	if(segment.second < range.first || range.second < segment.first || range.first == range.second)
+		return;
+
+	auto mid = range.first + (range.second - range.first) / 2;
+
+	if(segment.first <= mid) _query(cur->left(), segment, func, result, found);
+	if(mid < segment.second) _query(cur->right(), segment, func, result, found);
+}
+
+/**
+ ******************************************** View methods ********************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+snapshot_tree<_tvalue, _tindex, _functor>::view::view() : _root(nullptr) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+snapshot_tree<_tvalue, _tindex, _functor>::view::view(node* root, const _functor& func) : _root(root), _func(func) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+snapshot_tree<_tvalue, _tindex, _functor>::view::view(const view& other) : _root(_retain(other._root)), _func(other._func) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename snapshot_tree<_tvalue, _tindex, _functor>::view&
+snapshot_tree<_tvalue, _tindex, _functor>::view::operator=(const view& other) {
+	node* root = _retain(other._root);
+	_release(_root);
+
+	_root = root;
+	_func = other._func;
+	return *this;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+snapshot_tree<_tvalue, _tindex, _functor>::view::~view() {
+	_release(_root);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue snapshot_tree<_tvalue, _tindex, _functor>::view::query(const _tindex& start, const _tindex& end) const {
+	return _query(_root, std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end)), _func);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue snapshot_tree<_tvalue, _tindex, _functor>::view::query(const std::pair<_tindex, _tindex>& range) const {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue snapshot_tree<_tvalue, _tindex, _functor>::view::operator[](const _tindex& index) const {
+	const node* leaf = _find(_root, key<_tindex>::encode(index));
+	return leaf == nullptr ? _tvalue() : leaf->value();
+}
+
+}
+
+#endif
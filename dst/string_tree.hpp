@@ -0,0 +1,409 @@
+/**
+ * @file string_tree.hpp
+ * @brief Implementation of the dynamic segment tree over byte-string indices.
+ */
+
+#ifndef DST_STRING_TREE_HPP_
+#define DST_STRING_TREE_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "bit.hpp"
+
+namespace dst {
+
+/**
+ * @brief The dynamic segment tree over byte strings, ordered lexicographically.
+ *
+ * This class implements the segment aggregation of tree over keys which are byte sequences rather than words. Each key is
+ * read as a sequence of bits in which every byte is preceded by a set bit and the key ends with a clear one, so comparing the
+ * bit sequences gives the lexicographic order of the strings (a prefix being smaller than its extensions). The nodes form a
+ * binary radix tree with path compression: a node covers every key sharing its first bits, and its two children split them
+ * on the next bit. Besides the operations of tree, the strings sharing a prefix can be aggregated directly.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, class _functor = std::plus<_tvalue>>
+class string_tree {
+public:
+	/**
+	 * @brief Constructor for the tree.
+	 */
+	string_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const std::string& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const std::string& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree.
+	 * @param index The index to be removed.
+	 */
+	void erase(const std::string& index);
+
+	/**
+	 * @brief Aggregate the values in the given lexicographic range for which the indices exist in the tree. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::string& start, const std::string& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given lexicographic range for which the indices exist in the tree. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<std::string, std::string>& range) const;
+
+	/**
+	 * @brief Aggregate the values of the indices starting with a given prefix, the prefix itself included.
+	 * @param prefix The prefix to query.
+	 * @return The aggregate value of the indices with the prefix.
+	 */
+	_tvalue query_prefix(const std::string& prefix) const;
+
+	/**
+	 * @brief Access the value at a given index in the tree.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const std::string& index) const;
+
+	/**
+	 * @brief Clear the tree by deleting all the nodes.
+	 */
+	void clear();
+
+	/**
+	 * @brief Destructor for the tree.
+	 */
+	~string_tree();
+
+private:
+	/**
+	 * @brief The node structure of the tree.
+	 *
+	 * Each node holds the leading bits shared by all the keys below it, as the bytes containing them and the amount of
+	 * bits, a value, and pointers to its children. Leaves hold their whole key, terminating bit included.
+	 */
+	class node {
+	private:
+		std::string _key;
+		std::size_t _depth;
+		_tvalue _value;
+
+		node* _left;
+		node* _right;
+
+	public:
+		node(const std::string& key, std::size_t depth, const _tvalue& value, node* l, node* r)
+			: _key(key), _depth(depth), _value(value), _left(l), _right(r) {}
+
+		node(const std::string& key, const _tvalue& value)
+			: node(key, key.size() * 9 + 1, value, nullptr, nullptr) {}
+
+		const std::string& key() const { return _key; }
+		std::size_t depth() const { return _depth; }
+		bool leaf() const { return _left == nullptr; }
+
+		_tvalue& value() { return _value; }
+
+		node*& left() { return _left; }
+		node*& right() { return _right; }
+	};
+
+	/**
+	 * @brief The root node of the tree.
+	 */
+	node* _root;
+
+	/**
+	 * @brief Aggregation functor used by the tree.
+	 */
+	_functor _func;
+
+	/**
+	 * @brief Internal function to read a bit of the encoded form of a key.
+	 * @param index The key to read.
+	 * @param position The position of the bit.
+	 * @return The bit at the position, clear past the end of the key.
+	 */
+	static bool _bit(const std::string& index, std::size_t position);
+
+	/**
+	 * @brief Internal function to find the first bit at which the encoded forms of two keys differ.
+	 * @return The position of the first differing bit, or std::string::npos if the keys are equal.
+	 */
+	static std::size_t _mismatch(const std::string& first, const std::string& second);
+
+	/**
+	 * @brief Internal function to insert or aggregate a value at a given index in the tree.
+	 *
+	 * If the index leaves the subtree above the node's depth, a new node is created at the first differing bit with the
+	 * current node and a new leaf as children.
+	 *
+	 * @param cur The current node.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 * @param combine Whether to aggregate the value to an existing one instead of replacing it.
+	 * @return The new root of the subtree.
+	 */
+	node* _insert(node* cur, const std::string& index, const _tvalue& value, bool combine);
+
+	/**
+	 * @brief Internal function to erase a value at a given index in the tree, pruning its parent like tree does.
+	 * @param cur The current node.
+	 * @param index The index to erase the value.
+	 * @return The new root of the subtree.
+	 */
+	node* _erase(node* cur, const std::string& index);
+
+	/**
+	 * @brief Internal function to query the aggregate value of a given range in the tree.
+	 *
+	 * A bound is compared against the shared bits of a node once: if it differs above the node's depth, the whole subtree
+	 * lies on one side of it and the bound is dropped for the descendants. Only the nodes found are aggregated, the first
+	 * one replacing the result, as in tree.
+	 *
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @param low Whether the start of the range still has to be checked.
+	 * @param high Whether the end of the range still has to be checked.
+	 * @param result The aggregate value so far.
+	 * @param found Whether a node was aggregated so far.
+	 */
+	void _query(node* cur, const std::pair<std::string, std::string>& segment, bool low, bool high, _tvalue& result,
+		bool& found) const;
+
+	/**
+	 * @brief Internal function to clear the tree.
+	 * @param cur The current node.
+	 */
+	void _clear(node* cur);
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, class _functor>
+string_tree<_tvalue, _functor>::string_tree() : _root(nullptr) {}
+
+template<typename _tvalue, class _functor>
+string_tree<_tvalue, _functor>::~string_tree() {
+	clear();
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, class _functor>
+void string_tree<_tvalue, _functor>::insert(const std::string& index, const _tvalue& value) {
+	_root = _insert(_root, index, value, false);
+}
+
+template<typename _tvalue, class _functor>
+void string_tree<_tvalue, _functor>::apply(const std::string& index, const _tvalue& value) {
+	_root = _insert(_root, index, value, true);
+}
+
+template<typename _tvalue, class _functor>
+void string_tree<_tvalue, _functor>::erase(const std::string& index) {
+	_root = _erase(_root, index);
+}
+
+template<typename _tvalue, class _functor>
+_tvalue string_tree<_tvalue, _functor>::query(const std::string& start, const std::string& end) const {
+	return query(std::make_pair(start, end));
+}
+
+template<typename _tvalue, class _functor>
+_tvalue string_tree<_tvalue, _functor>::query(const std::pair<std::string, std::string>& range) const {
+	_tvalue result = _tvalue();
+	bool found = false;
+
+	_query(_root, range, true, true, result, found);
+	return result;
+}
+
+template<typename _tvalue, class _functor>
+_tvalue string_tree<_tvalue, _functor>::query_prefix(const std::string& prefix) const {
+	// The keys with the prefix are those matching its encoded form up to, but excluding, the terminating bit
+	std::size_t length = prefix.size() * 9;
+	node* cur = _root;
+
+	while(cur != nullptr) {
+		std::size_t shared = _mismatch(cur->key(), prefix);
+		if(shared < cur->depth() && shared < length) return _tvalue();
+		if(cur->depth() >= length) return cur->value();
+
+		cur = _bit(prefix, cur->depth()) ? cur->right() : cur->left();
+	}
+
+	return _tvalue();
+}
+
+template<typename _tvalue, class _functor>
+_tvalue string_tree<_tvalue, _functor>::operator[](const std::string& index) const {
+	node* cur = _root;
+
+	while(cur != nullptr && !cur->leaf())
+		cur = _bit(index, cur->depth()) ? cur->right() : cur->left();
+
+	if(cur == nullptr || cur->key() != index) return _tvalue();
+	return cur->value();
+}
+
+template<typename _tvalue, class _functor>
+void string_tree<_tvalue, _functor>::clear() {
+	_clear(_root);
+	_root = nullptr;
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, class _functor>
+bool string_tree<_tvalue, _functor>::_bit(const std::string& index, std::size_t position) {
+	std::size_t symbol = position / 9, offset = position % 9;
+
+	if(symbol >= index.size()) return false; // Terminated
+	if(offset == 0) return true; // Continued
+
+	return (static_cast<unsigned char>(index[symbol]) >> (8 - offset)) & 1;
+}
+
+template<typename _tvalue, class _functor>
+std::size_t string_tree<_tvalue, _functor>::_mismatch(const std::string& first, const std::string& second) {
+	std::size_t length = (first.size() < second.size()) ? first.size() : second.size();
+	std::size_t symbol = 0;
+
+	while(symbol < length && first[symbol] == second[symbol]) ++symbol;
+
+	if(symbol == length) { // One is a prefix of the other, they differ at a terminating bit
+		if(first.size() == second.size()) return std::string::npos;
+		return symbol * 9;
+	}
+
+	unsigned char diff = static_cast<unsigned char>(first[symbol]) ^ static_cast<unsigned char>(second[symbol]);
+	return symbol * 9 + 8 - bit::log(diff);
+}
+
+template<typename _tvalue, class _functor>
+typename string_tree<_tvalue, _functor>::node*
+string_tree<_tvalue, _functor>::_insert(node* cur, const std::string& index, const _tvalue& value, bool combine) {
+	if(cur == nullptr) return new node(index, value);
+
+	std::size_t shared = _mismatch(cur->key(), index);
+
+	if(shared < cur->depth()) { // Diverged above the node, split at the first differing bit
+		node* leaf = new node(index, value);
+		node* par = _bit(index, shared)
+			? new node(index.substr(0, shared / 9 + 1), shared, _tvalue(), cur, leaf)
+			: new node(index.substr(0, shared / 9 + 1), shared, _tvalue(), leaf, cur);
+
+		par->value() = _func(par->left()->value(), par->right()->value());
+		return par;
+	}
+
+	if(cur->leaf()) { // Collided, update the value
+		cur->value() = combine ? _func(cur->value(), value) : value;
+		return cur;
+	}
+
+	auto& branch = _bit(index, cur->depth()) ? cur->right() : cur->left();
+	branch = _insert(branch, index, value, combine);
+
+	cur->value() = _func(cur->left()->value(), cur->right()->value());
+	return cur;
+}
+
+template<typename _tvalue, class _functor>
+typename string_tree<_tvalue, _functor>::node*
+string_tree<_tvalue, _functor>::_erase(node* cur, const std::string& index) {
+	if(cur == nullptr) return nullptr;
+
+	if(cur->leaf()) { // Only erase if found
+		if(cur->key() != index) return cur;
+		delete cur;
+		return nullptr;
+	}
+
+	auto& branch = _bit(index, cur->depth()) ? cur->right() : cur->left();
+	branch = _erase(branch, index);
+
+	if(!cur->left() ^ !cur->right()) { // Prune the excessive parent
+		node* child = (cur->left() == nullptr) ? cur->right() : cur->left();
+		delete cur;
+		return child;
+	}
+
+	cur->value() = _func(cur->left()->value(), cur->right()->value());
+	return cur;
+}
+
+template<typename _tvalue, class _functor>
+void string_tree<_tvalue, _functor>::_query(node* cur, const std::pair<std::string, std::string>& segment, bool low, bool high,
+	_tvalue& result, bool& found) const {
+
+	if(cur == nullptr) return;
+
+	if(low) {
+		std::size_t shared = _mismatch(cur->key(), segment.first);
+
+		if(shared < cur->depth()) {
+			if(_bit(segment.first, shared)) return; // Every key is below the start
+			low = false;
+		}
+		else if(cur->leaf()) low = false; // Equal to the start
+	}
+
+	if(high) {
+		std::size_t shared = _mismatch(cur->key(), segment.second);
+
+		if(shared < cur->depth()) {
+			if(!_bit(segment.second, shared)) return; // Every key is above the end
+			high = false;
+		}
+		else if(cur->leaf()) high = false; // Equal to the end
+	}
+
+	if(!low && !high) {
+		result = found ? _func(result, cur->value()) : cur->value();
+		found = true;
+		return;
+	}
+
+	_query(cur->left(), segment, low, high, result, found);
+	_query(cur->right(), segment, low, high, result, found);
+}
+
+template<typename _tvalue, class _functor>
+void string_tree<_tvalue, _functor>::_clear(node* cur) {
+	if(cur == nullptr) return;
+	_clear(cur->left());
+	_clear(cur->right());
+
+	delete cur;
+}
+
+}
+
+#endif
@@ -0,0 +1,236 @@
+/**
+ * @file thread_pool.hpp
+ * @brief Implementation of the work-stealing thread pool running the parallel parts of the structures.
+ */
+
+#ifndef DST_THREAD_POOL_HPP_
+#define DST_THREAD_POOL_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dst {
+
+/**
+ * @brief A fixed set of worker threads running submitted tasks, each worker with a queue of its own.
+ *
+ * A task submitted by a worker goes to the back of its own queue, where the worker takes it back first, so that the tasks
+ * forked by a recursive algorithm run on the core that holds their data. A worker out of tasks steals from the front of
+ * the other queues, which holds the oldest and thus largest tasks. Tasks submitted from outside the pool are spread over
+ * the queues in turn.
+ *
+ * A thread waiting for the result of a task through wait runs the pending tasks itself in the meantime, so that tasks may
+ * submit and wait for other tasks, even from the workers, without exhausting the pool. The structures share the pool given
+ * by shared unless they are handed one.
+ */
+class thread_pool {
+public:
+	/**
+	 * @brief Constructor for the pool.
+	 * @param threads The amount of worker threads, default to the amount of hardware threads.
+	 */
+	explicit thread_pool(std::size_t threads = std::thread::hardware_concurrency()) : _pending(0), _next(0), _stop(false) {
+		if(threads == 0) threads = 1;
+
+		for(std::size_t i = 0; i < threads; ++i) _queues.emplace_back(new queue());
+		for(std::size_t i = 0; i < threads; ++i) _workers.emplace_back([this, i] { _work(i); });
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	/**
+	 * @brief Destructor for the pool, which finishes the pending tasks before joining the workers.
+	 */
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> guard(_mutex);
+			_stop = true;
+		}
+
+		_ready.notify_all();
+		for(std::thread& worker : _workers) worker.join();
+	}
+
+	/**
+	 * @brief Submit a task to the pool.
+	 * @param task The task, callable without arguments.
+	 * @return The future result of the task.
+	 */
+	template<class _task>
+	auto submit(_task task) -> std::future<decltype(task())> {
+		using _tresult = decltype(task());
+
+		// Held by a shared pointer since std::function requires copyable targets
+		auto job = std::make_shared<std::packaged_task<_tresult()>>(std::move(task));
+		std::future<_tresult> result = job->get_future();
+
+		std::size_t target = _self().pool == this ? _self().index : _next.fetch_add(1, std::memory_order_relaxed) % _queues.size();
+
+		_pending.fetch_add(1, std::memory_order_release);
+
+		{
+			std::lock_guard<std::mutex> guard(_queues[target]->lock);
+			_queues[target]->tasks.emplace_back([job] { (*job)(); });
+		}
+
+		{
+			// Signalled under the mutex of the workers, so that none is about to sleep past the task
+			std::lock_guard<std::mutex> guard(_mutex);
+			_ready.notify_one();
+		}
+
+		return result;
+	}
+
+	/**
+	 * @brief Wait for the result of a task, running the pending tasks in the meantime.
+	 * @param result The future result of the task.
+	 * @return The result of the task.
+	 */
+	template<typename _type>
+	_type wait(std::future<_type>& result) {
+		std::size_t home = _self().pool == this ? _self().index : 0;
+
+		while(result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			if(!_run_one(home)) result.wait_for(std::chrono::microseconds(50));
+
+		return result.get();
+	}
+
+	/**
+	 * @brief The amount of worker threads.
+	 */
+	std::size_t size() const {
+		return _workers.size();
+	}
+
+	/**
+	 * @brief The pool shared by the structures, created on first use with one worker per hardware thread.
+	 */
+	static thread_pool& shared() {
+		static thread_pool pool;
+		return pool;
+	}
+
+private:
+	/**
+	 * @brief The queue of a worker.
+	 */
+	struct queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	/**
+	 * @brief The pool and the index of the worker run by a thread, if any.
+	 */
+	struct identity {
+		const thread_pool* pool;
+		std::size_t index;
+	};
+
+	/**
+	 * @brief The worker threads.
+	 */
+	std::vector<std::thread> _workers;
+
+	/**
+	 * @brief The queues of the workers.
+	 */
+	std::vector<std::unique_ptr<queue>> _queues;
+
+	/**
+	 * @brief The amount of tasks in the queues.
+	 */
+	std::atomic<std::size_t> _pending;
+
+	/**
+	 * @brief The queue receiving the next task submitted from outside the pool.
+	 */
+	std::atomic<std::size_t> _next;
+
+	/**
+	 * @brief The mutex the idle workers sleep on.
+	 */
+	std::mutex _mutex;
+
+	/**
+	 * @brief Signals a new task or the destruction of the pool to the workers.
+	 */
+	std::condition_variable _ready;
+
+	/**
+	 * @brief Whether the pool is being destroyed.
+	 */
+	bool _stop;
+
+	/**
+	 * @brief Internal function to give the identity of the calling thread.
+	 */
+	static identity& _self() {
+		thread_local identity self = {nullptr, 0};
+		return self;
+	}
+
+	/**
+	 * @brief Internal function to run one pending task on the calling thread.
+	 * @param home The queue of the calling thread, taken from the back, the others being stolen from the front.
+	 * @return Whether there was a task to run.
+	 */
+	bool _run_one(std::size_t home) {
+		if(_pending.load(std::memory_order_acquire) == 0) return false;
+
+		std::function<void()> task;
+
+		for(std::size_t i = 0; i < _queues.size() && !task; ++i) {
+			queue& cur = *_queues[(home + i) % _queues.size()];
+			std::lock_guard<std::mutex> guard(cur.lock);
+			if(cur.tasks.empty()) continue;
+
+			if(i == 0) {
+				task = std::move(cur.tasks.back());
+				cur.tasks.pop_back();
+			}
+			else {
+				task = std::move(cur.tasks.front());
+				cur.tasks.pop_front();
+			}
+		}
+
+		if(!task) return false;
+
+		_pending.fetch_sub(1, std::memory_order_relaxed);
+		task();
+		return true;
+	}
+
+	/**
+	 * @brief Internal function run by the workers.
+	 * @param index The index of the worker.
+	 */
+	void _work(std::size_t index) {
+		_self() = identity{this, index};
+
+		while(true) {
+			if(_run_one(index)) continue;
+
+			std::unique_lock<std::mutex> guard(_mutex);
+			_ready.wait(guard, [this] { return _stop || _pending.load(std::memory_order_acquire) > 0; });
+			if(_stop && _pending.load(std::memory_order_acquire) == 0) return;
+		}
+	}
+};
+
+}
+
+#endif
@@ -6,8 +6,19 @@
 #ifndef DST_TREE_HPP_
 #define DST_TREE_HPP_
 
+#include <algorithm>
+#include <cstddef>
+#include <exception>
 #include <functional>
+#include <future>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#include "bit.hpp"
+#include "key.hpp"
+#include "flat_tree.hpp"
+#include "thread_pool.hpp"
 
 namespace dst {
 
@@ -23,11 +34,21 @@ namespace dst {
  * 
  * - Querying the aggregate value of a given range.
  *
+ * Indices are mapped to unsigned keys through the order-preserving transform of key, on which every node covers an aligned
+ * block of keys whose size is a power of 2. Floating-point indices are therefore ordered exactly like the numbers they hold,
+ * without any scaling. Index types with a small universe (see universe) are specialized at compile time as a flat_tree with
+ * the same interface.
+ *
+ * The const methods only read the nodes, so any amount of threads may query a tree at once, but a modification must not run
+ * concurrently with any other call. See concurrent_tree for a tree shared between threads.
+ *
  * @tparam _tvalue The type of the values stored in the tree indices.
- * @tparam _tindex The type of the indices used in the tree, which can be different from the type of the values but must be integral.
+ * @tparam _tindex The type of the indices used in the tree, which can be different from the type of the values but must be
+ * integral (128-bit included), floating-point, or a std::pair of those ordered lexicographically.
  * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ * @tparam _flat Whether the tree is a flat_tree, given by the universe of the index type and not meant to be set by hand.
  */
-template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>, bool _flat = (universe<_tindex>::value > 0)>
 class tree {
 public:
 	/**
@@ -61,21 +82,150 @@ public:
 	 * @param end The end of the range to query.
 	 * @return The aggregate value of the range.
 	 */
-	_tvalue query(const _tindex& start, const _tindex& end);
+	_tvalue query(const _tindex& start, const _tindex& end) const;
 
 	/**
 	 * @brief Aggregate the values in the given range for which the indices exist in the tree. The range is inclusive.
 	 * @param segment The range to query.
 	 * @return The aggregate value of the range.
 	 */
-	_tvalue query(const std::pair<_tindex, _tindex>& range);
+	_tvalue query(const std::pair<_tindex, _tindex>& range) const;
+
+	/**
+	 * @brief Aggregate the values in the given range, telling whether any index of the range exists in the tree.
+	 *
+	 * This lets the results of several trees be combined without aggregating the default value of an empty range.
+	 *
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @param result The aggregate value of the range, left unchanged if there is none.
+	 * @return Whether an index of the range exists in the tree.
+	 */
+	bool query(const _tindex& start, const _tindex& end, _tvalue& result) const;
+
+	/**
+	 * @brief Aggregate the values in the given range, combining the nodes covering it in parallel on a pool.
+	 *
+	 * The nodes covering the range are collected in key order, split into chunks of at least grain nodes, and each chunk is
+	 * aggregated by a task of the pool before the partial results are combined in order. This pays off for functors taking
+	 * long to aggregate two values, such as products of matrices or merges of sketches. Arithmetic values, and ranges
+	 * covered by less than two chunks, are aggregated serially as in query. If the functor throws, the exception is rethrown
+	 * once every task is over.
+	 *
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @param pool The pool aggregating the chunks.
+	 * @param grain The least amount of nodes aggregated by a task.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end, thread_pool& pool, std::size_t grain = 4) const;
 
 	/**
 	 * @brief Access the value at a given index in the tree.
 	 * @param index The index to access.
 	 * @return The value at the index.
 	 */
-	_tvalue operator[](const _tindex& index);
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Find the first index at which the aggregate of the values up to it satisfies a predicate.
+	 *
+	 * The predicate must be monotone over the prefixes of the tree, false up to some index and true from there on, such as
+	 * a running sum of non-negative values reaching a threshold. The search takes a single descent from the root.
+	 *
+	 * @param predicate The predicate on the aggregate values.
+	 * @param index The index found, left unchanged if there is none.
+	 * @return Whether an index satisfies the predicate.
+	 */
+	template<class _predicate>
+	bool search(_predicate predicate, _tindex& index) const;
+
+	/**
+	 * @brief The orders in which parallel_for_each visits the indices.
+	 */
+	enum order {
+		unordered, ///< The function is called from the tasks of the pool, concurrently and in any order.
+		ordered    ///< The function is called from the calling thread in the order of the indices.
+	};
+
+	/**
+	 * @brief Call a function on every index in the given range, with its value, in the order of the indices.
+	 * @param start The start of the range, inclusive.
+	 * @param end The end of the range, inclusive.
+	 * @param function The function, called with the index and the value.
+	 */
+	template<class _function>
+	void for_each(const _tindex& start, const _tindex& end, _function function) const;
+
+	/**
+	 * @brief Call a function on every index in the given range, with its value, visiting the subtrees in parallel on a pool.
+	 *
+	 * The leaves of the subtrees covering the range are first counted in parallel, which walks the range once more than the
+	 * visit itself, and the heaviest subtree is split until none holds more than a small share of the leaves. Consecutive
+	 * pieces are then grouped into parts of about the same amount of leaves, each visited by a task.
+	 * Unordered visits call the function from the tasks, so it must be safe to call concurrently. Ordered visits have the
+	 * tasks gather the entries of their parts, a few parts ahead of the calling thread, which calls the function on them in
+	 * order. The tree must not be modified during the visit.
+	 *
+	 * @param start The start of the range, inclusive.
+	 * @param end The end of the range, inclusive.
+	 * @param function The function, called with the index and the value.
+	 * @param pool The pool visiting the parts.
+	 * @param visit The order of the calls.
+	 */
+	template<class _function>
+	void parallel_for_each(const _tindex& start, const _tindex& end, _function function, thread_pool& pool,
+		order visit = unordered) const;
+
+	/**
+	 * @brief An operation of a batch, see batch.
+	 */
+	struct operation {
+		enum kind { insert, apply, erase };
+
+		kind type;
+		_tindex index;
+		_tvalue value;
+	};
+
+	/**
+	 * @brief Perform a batch of operations at once.
+	 *
+	 * The operations are sorted by index, keeping the order of those on the same index, and pushed down the tree together.
+	 * Each node on their paths is thus visited and recomputed once for the whole batch instead of once per operation, which
+	 * pays off when the indices are close to one another.
+	 *
+	 * @param first The first operation of the batch.
+	 * @param last The end of the batch.
+	 */
+	template<class _iterator>
+	void batch(_iterator first, _iterator last);
+
+	/**
+	 * @brief Replace the content of the tree by the given entries, building it bottom-up.
+	 *
+	 * Every node of the result is created once with its final range and value, which takes linear time on entries sorted by
+	 * index. Unsorted entries are sorted first, and the last value of an index given several times is kept.
+	 *
+	 * @param first The first entry, a std::pair of an index and its value.
+	 * @param last The end of the entries.
+	 */
+	template<class _iterator>
+	void build(_iterator first, _iterator last);
+
+	/**
+	 * @brief Replace the content of the tree by the given entries, building the subtrees in parallel on a pool.
+	 *
+	 * The sorted entries are split at the middle of the aligned block covering them, which is where the node holding them
+	 * splits its range, and the two halves are built as tasks of the pool. Subtrees of few entries are built serially. The
+	 * functor must not throw, since the subtrees built by the other tasks would leak.
+	 *
+	 * @param first The first entry, a std::pair of an index and its value.
+	 * @param last The end of the entries.
+	 * @param pool The pool building the subtrees.
+	 */
+	template<class _iterator>
+	void build(_iterator first, _iterator last, thread_pool& pool);
 
 	/**
 	 * @brief Clear the tree by deleting all the nodes.
@@ -87,17 +237,38 @@ public:
 	 */
 	~tree();	
 
+	/**
+	 * @brief A cursor remembering the last path it visited, for operations on nearby indices.
+	 *
+	 * Each operation climbs from the remembered node through the parent links to the lowest ancestor covering the new
+	 * indices, then descends from there, so the search costs O(1 + log distance) instead of starting at the root. Updates
+	 * still refresh the aggregates of every ancestor up to the root. Erasing from the tree or clearing it sends the fingers
+	 * back to the root, so they never point to deleted nodes.
+	 */
+	class finger;
+
 private:
+	/**
+	 * @brief The unsigned key type the indices are mapped to.
+	 */
+	using _tkey = typename key<_tindex>::type;
+
 	/**
 	 * @brief The node structure of the tree.
 	 * 
-	 * This structure defines a node of the dynamic segment tree. Each node contains a range of indices, a value,
-	 * and pointers to its parent, left child, and right child.
+	 * This structure defines a node of the dynamic segment tree. Each node contains an inclusive range of keys, a value,
+	 * and pointers to its parent, left child, and right child. Leaves hold a single key, and the range of every other node
+	 * is an aligned block split in half between its two children.
+	 *
+	 * The range is stored as a single key: a leaf keeps its own, and any other node the first key of its block with the
+	 * bits below the middle of the block set. The block is then the run of bits flipped by adding one to that key, so that
+	 * a node costs one key instead of two. Only the nodes with a child are decoded as blocks, which every other node has
+	 * once built.
 	 * 
 	 */
 	class node {
 	private:
-		std::pair<_tindex, _tindex> _range;
+		_tkey _key;
 		_tvalue _value;
 
 		node* _parent;
@@ -105,27 +276,36 @@ private:
 		node* _right;
 	
 	public:
-		node(const std::pair<_tindex, _tindex>& range, const _tvalue& value, node* p, node* l, node* r)
-			: _range(range), _value(value), _parent(p), _left(l), _right(r) {}
+		node(const std::pair<_tkey, _tkey>& range, const _tvalue& value, node* p, node* l, node* r)
+			: _key(_tkey(range.first | _tkey((range.second - range.first) >> 1))), _value(value), _parent(p), _left(l), _right(r) {}
 
-		node(const std::pair<_tindex, _tindex>& range, const _tvalue& value)
+		node(const std::pair<_tkey, _tkey>& range, const _tvalue& value)
 			: node(range, value, nullptr, nullptr, nullptr) {}
 		
-		node(const std::pair<_tindex, _tindex>& range)
+		node(const std::pair<_tkey, _tkey>& range)
 			: node(range, _tvalue()) {}
 
-		node(const _tindex& index, const _tvalue& value)
+		node(const _tkey& index, const _tvalue& value)
 			: node(std::make_pair(index, index), value) {}
 
-		node(const _tindex& index)
+		node(const _tkey& index)
 			: node(std::make_pair(index, index)) {}
 
 		_tvalue& value() { return _value; }
-		std::pair<_tindex, _tindex> range() { return _range; }
+		const _tvalue& value() const { return _value; }
+		std::pair<_tkey, _tkey> range() const {
+			if(_left == nullptr && _right == nullptr) return std::make_pair(_key, _key);
+
+			_tkey mask = _tkey(_key ^ _tkey(_key + 1));
+			return std::make_pair(_tkey(_key & ~mask), _tkey(_key | mask));
+		}
 
 		node*& parent() { return _parent; }
 		node*& left() { return _left; }
 		node*& right() { return _right; }
+
+		const node* left() const { return _left; }
+		const node* right() const { return _right; }
 	};
 
 	/**
@@ -138,18 +318,23 @@ private:
 	 */
 	_functor _func;
 
+	/**
+	 * @brief Counter of the removals of nodes, used to detect fingers pointing to deleted nodes.
+	 */
+	std::size_t _version;
+
 	/**
 	 * @brief Internal function to extend the range of a node to include a given index.
 	 * 
 	 * If the index is outside the current range of the node, this method creates a new node with the extended range.
-	 * The range is extended to the nearest power of 2 that includes the index such that the endpoints are consistent
-	 * with the rest of the tree.
+	 * The range is extended to the smallest aligned block that includes the index, which is found from the highest bit
+	 * where the index differs from the node's range, so that the endpoints are consistent with the rest of the tree.
 	 * 
 	 * @param cur The current node.
 	 * @param index The index to include in the range.
 	 * @return The new node with the extended range.
 	 */
-	node* _extend(node* cur, const _tindex& index);
+	node* _extend(node* cur, const _tkey& index);
 
 	/**
 	 * @brief Internal function to insert a value at a given index in the tree.
@@ -161,7 +346,7 @@ private:
 	 * @param value The value to insert.
 	 * @return The root of the tree.
 	 */
-	node* _insert(node* cur, const _tindex& index, const _tvalue& value);
+	node* _insert(node* cur, const _tkey& index, const _tvalue& value);
 
 	/**
 	 * @brief Internal function to aggregate a value to a given index in the tree.
@@ -174,7 +359,7 @@ private:
 	 * @param value The value to apply.
 	 * @return The root of the tree.
 	 */
-	node* _apply(node* cur, const _tindex& index, const _tvalue& value);
+	node* _apply(node* cur, const _tkey& index, const _tvalue& value);
 
 	/**
 	 * @brief Internal function to erase a value at a given index in the tree.
@@ -186,7 +371,7 @@ private:
 	 * @param index The index to erase the value.
 	 * @return The root of the tree.
 	 */
-	node* _erase(node* cur, const _tindex& index);
+	node* _erase(node* cur, const _tkey& index);
 
 	/**
 	 * @brief Internal function to query the aggregate value of a given range in the tree.
@@ -197,7 +382,77 @@ private:
 	 * @param segment The range to query.
 	 * @return The aggregate value of the range.
 	 */
-	_tvalue _query(node* cur, const std::pair<_tindex, _tindex>& segment) const;
+	_tvalue _query(const node* cur, const std::pair<_tkey, _tkey>& segment) const;
+
+	/**
+	 * @brief Internal function to aggregate the nodes covering a range into a result, in key order.
+	 *
+	 * Only the nodes found are aggregated, the first one replacing the result, so that the functor never sees a default
+	 * value standing for a missing subtree.
+	 *
+	 * @param cur The current node.
+	 * @param segment The range to query.
+	 * @param result The aggregate value so far.
+	 * @param found Whether a node was aggregated so far.
+	 */
+	void _query(const node* cur, const std::pair<_tkey, _tkey>& segment, _tvalue& result, bool& found) const;
+
+	/**
+	 * @brief Internal function to collect the nodes covering a range, in key order, as visited by _query.
+	 * @param cur The current node.
+	 * @param segment The range to cover.
+	 * @param cover The nodes covering the range.
+	 */
+	void _cover(const node* cur, const std::pair<_tkey, _tkey>& segment, std::vector<const node*>& cover) const;
+
+	/**
+	 * @brief Internal function to aggregate the values of consecutive nodes.
+	 * @param first The first node.
+	 * @param last The end of the nodes.
+	 * @return The aggregate value of the nodes.
+	 */
+	_tvalue _fold(const node* const* first, const node* const* last) const;
+
+	/**
+	 * @brief Internal function to call a function on the leaves of a subtree inside a range, in the order of the keys.
+	 * @param cur The root of the subtree.
+	 * @param segment The range to visit.
+	 * @param function The function, called with the index and the value.
+	 */
+	template<class _function>
+	void _visit(const node* cur, const std::pair<_tkey, _tkey>& segment, _function& function) const;
+
+	/**
+	 * @brief Internal function to count the leaves of a subtree.
+	 * @param cur The root of the subtree.
+	 * @return The amount of leaves.
+	 */
+	static std::size_t _count(const node* cur);
+
+	/**
+	 * @brief Internal function to count the leaves of a subtree, keeping the sizes of its heaviest subtrees.
+	 *
+	 * The sizes of at least floor leaves are kept, the floor doubling whenever more than limit sizes are kept, so that the
+	 * kept sizes are those of every subtree of at least the final floor.
+	 *
+	 * @param cur The root of the subtree.
+	 * @param sizes The subtrees kept with their amount of leaves.
+	 * @param floor The least amount of leaves of the kept subtrees.
+	 * @param limit The amount of kept subtrees doubling the floor.
+	 * @return The amount of leaves.
+	 */
+	static std::size_t _count(const node* cur, std::vector<std::pair<const node*, std::size_t>>& sizes, std::size_t& floor,
+		std::size_t limit);
+
+	/**
+	 * @brief Internal function to split the subtrees covering a range into pieces, grouped into parts of balanced leaves.
+	 * @param segment The range to split.
+	 * @param pool The pool counting the leaves.
+	 * @param pieces The pieces, in the order of the keys.
+	 * @param bounds The index of the first piece of every part, followed by the amount of pieces.
+	 */
+	void _partition(const std::pair<_tkey, _tkey>& segment, thread_pool& pool, std::vector<const node*>& pieces,
+		std::vector<std::size_t>& bounds) const;
 
 	/**
 	 * @brief Internal function to clear the tree.
@@ -207,17 +462,155 @@ private:
 	 * @param cur The current node.
 	 */
 	void _clear(node* cur);
+
+	/**
+	 * @brief Internal function to recompute the aggregates of the ancestors of a node, up to the root.
+	 * @param cur The current node.
+	 */
+	void _refresh(node* cur);
+
+	/**
+	 * @brief An operation of a batch, by key.
+	 */
+	using _tentry = std::pair<_tkey, const operation*>;
+
+	/**
+	 * @brief Internal function to perform a sorted batch of operations on a subtree.
+	 *
+	 * The subtree is first extended once to cover every key of the batch, then the operations are split at the middle of
+	 * the range and each half goes to its child. A node left with a single child is replaced by it, as in erase.
+	 *
+	 * @param cur The root of the subtree.
+	 * @param first The first operation of the batch.
+	 * @param last The end of the batch.
+	 * @return The new root of the subtree.
+	 */
+	node* _batch(node* cur, const _tentry* first, const _tentry* last);
+
+	/**
+	 * @brief Internal function to fold the operations of a batch on a single key.
+	 * @param first The first operation on the key.
+	 * @param last The end of the operations on the key.
+	 * @param present Whether the key is in the tree, updated by the operations.
+	 * @param value The value at the key, updated by the operations.
+	 */
+	void _resolve(const _tentry* first, const _tentry* last, bool& present, _tvalue& value) const;
+
+	/**
+	 * @brief An entry of a build, by key.
+	 */
+	using _tpair = std::pair<_tkey, _tvalue>;
+
+	/**
+	 * @brief The amount of entries below which a subtree is built serially.
+	 */
+	static constexpr std::size_t _grain = 4096;
+
+	/**
+	 * @brief Internal function to replace the content of the tree by the given entries.
+	 * @param first The first entry.
+	 * @param last The end of the entries.
+	 * @param pool The pool building the subtrees, or nullptr to build serially.
+	 */
+	template<class _iterator>
+	void _assign(_iterator first, _iterator last, thread_pool* pool);
+
+	/**
+	 * @brief Internal function to build the subtree of sorted entries with distinct keys.
+	 * @param first The first entry.
+	 * @param last The end of the entries, after first.
+	 * @param pool The pool building the subtrees, or nullptr to build serially.
+	 * @return The root of the subtree.
+	 */
+	node* _build(const _tpair* first, const _tpair* last, thread_pool* pool) const;
+};
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+class tree<_tvalue, _tindex, _functor, _flat>::finger {
+public:
+	/**
+	 * @brief Constructor for the finger, starting at the root of the tree.
+	 * @param owner The tree to operate on.
+	 */
+	finger(tree& owner);
+
+	/**
+	 * @brief Insert a value at a given index in the tree, searching from the finger.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 */
+	void insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree, searching from the finger.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 */
+	void apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate the values in the given range, starting from the finger. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end);
+
+	/**
+	 * @brief Aggregate the values in the given range, starting from the finger. The range is inclusive.
+	 * @param range The range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const std::pair<_tindex, _tindex>& range);
+
+	/**
+	 * @brief Access the value at a given index in the tree, searching from the finger.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index);
+
+private:
+	/**
+	 * @brief The tree the finger operates on.
+	 */
+	tree* _tree;
+
+	/**
+	 * @brief The node the finger rests on.
+	 */
+	node* _node;
+
+	/**
+	 * @brief The removal counter of the tree when the node was reached.
+	 */
+	std::size_t _version;
+
+	/**
+	 * @brief Internal function to climb to the lowest ancestor covering a range of keys, or to the root.
+	 * @param first The first key of the range.
+	 * @param last The last key of the range.
+	 * @return The ancestor, null if the tree is empty.
+	 */
+	node* _climb(const _tkey& first, const _tkey& last);
+
+	/**
+	 * @brief Internal function to descend towards a key and rest the finger on the deepest node covering it.
+	 * @param cur The node to descend from.
+	 * @param index The key to descend to.
+	 */
+	void _settle(node* cur, const _tkey& index);
 };
 
 /**
  ************************************** Special member functions **************************************
  */
 
-template<typename _tvalue, typename _tindex, class _functor>
-tree<_tvalue, _tindex, _functor>::tree() : _root(nullptr) {}
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+tree<_tvalue, _tindex, _functor, _flat>::tree() : _root(nullptr), _version(0) {}
 
-template<typename _tvalue, typename _tindex, class _functor>
-tree<_tvalue, _tindex, _functor>::~tree() {
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+tree<_tvalue, _tindex, _functor, _flat>::~tree() {
 	clear();
 }
 
@@ -225,94 +618,236 @@ tree<_tvalue, _tindex, _functor>::~tree() {
  ******************************************* Public methods *******************************************
  */
 
-template<typename _tvalue, typename _tindex, class _functor>
-void tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
-	_insert(_root, index, value);
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::insert(const _tindex& index, const _tvalue& value) {
+	_insert(_root, key<_tindex>::encode(index), value);
 }
 
-template <typename _tvalue, typename _tindex, class _functor>
-void tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
-	_apply(_root, index, value);
+template <typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::apply(const _tindex& index, const _tvalue& value) {
+	_apply(_root, key<_tindex>::encode(index), value);
 }
 
-template <typename _tvalue, typename _tindex, class _functor>
-void tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
-	_erase(_root, index);
+template <typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::erase(const _tindex& index) {
+	_erase(_root, key<_tindex>::encode(index));
+	++_version;
 }
 
-template<typename _tvalue, typename _tindex, class _functor>
-_tvalue tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) {
-	return _query(_root, std::make_pair(start, end));
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::query(const _tindex& start, const _tindex& end) const {
+	return _query(_root, std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end)));
 }
 
-template<typename _tvalue, typename _tindex, class _functor>
-_tvalue tree<_tvalue, _tindex, _functor>::query(const std::pair<_tindex, _tindex>& range) {
-	return _query(_root, range);
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::query(const std::pair<_tindex, _tindex>& range) const {
+	return _query(_root, std::make_pair(key<_tindex>::encode(range.first), key<_tindex>::encode(range.second)));
 }
 
-template<typename _tvalue, typename _tindex, class _functor>
-_tvalue tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) {
-	return _query(_root, std::make_pair(index, index));
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+bool tree<_tvalue, _tindex, _functor, _flat>::query(const _tindex& start, const _tindex& end, _tvalue& result) const {
+	_tvalue value = _tvalue();
+	bool found = false;
+
+	_query(_root, std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end)), value, found);
+	if(found) result = value;
+	return found;
 }
 
-template<typename _tvalue, typename _tindex, class _functor>
-void tree<_tvalue, _tindex, _functor>::clear() {
-	_clear(_root);
-	_root = nullptr;
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::query(const _tindex& start, const _tindex& end, thread_pool& pool, std::size_t grain) const {
+	std::pair<_tkey, _tkey> segment = std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end));
+	if(std::is_arithmetic<_tvalue>::value) return _query(_root, segment);
+
+	std::vector<const node*> cover;
+	_cover(_root, segment, cover);
+
+	if(grain == 0) grain = 1;
+	if(cover.size() < grain * 2) return _fold(cover.data(), cover.data() + cover.size());
+
+	// The first chunk is aggregated by the calling thread, the others by the pool
+	const node* const* nodes = cover.data();
+	std::size_t chunks = cover.size() / grain;
+	std::vector<std::future<_tvalue>> parts;
+	std::exception_ptr error;
+	_tvalue result = _tvalue();
+
+	try {
+		for(std::size_t i = 1; i < chunks; ++i) {
+			const node* const* first = nodes + i * grain;
+			const node* const* last = (i + 1 == chunks) ? nodes + cover.size() : first + grain;
+			parts.push_back(pool.submit([this, first, last] { return _fold(first, last); }));
+		}
+
+		result = _fold(nodes, nodes + grain);
+	}
+	catch(...) { error = std::current_exception(); }
+
+	// Every part is waited for before rethrowing, since they refer to the cover
+	for(std::future<_tvalue>& part : parts) {
+		try {
+			_tvalue value = pool.wait(part);
+			if(!error) result = _func(result, value);
+		}
+		catch(...) { if(!error) error = std::current_exception(); }
+	}
+
+	if(error) std::rethrow_exception(error);
+	return result;
 }
 
-/**
- ******************************************* Private methods ******************************************
- */
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::operator[](const _tindex& index) const {
+	_tkey target = key<_tindex>::encode(index);
+	return _query(_root, std::make_pair(target, target));
+}
 
-template<typename _tvalue, typename _tindex, class _functor>
-typename tree<_tvalue, _tindex, _functor>::node*
-tree<_tvalue, _tindex, _functor>::_extend(node* cur, const _tindex& index) {
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+template<class _predicate>
+bool tree<_tvalue, _tindex, _functor, _flat>::search(_predicate predicate, _tindex& index) const {
+	if(_root == nullptr || !predicate(_root->value())) return false;
+
+	// Going right carries the aggregate of the left sibling along as the prefix, which starts with the first one passed so
+	// that the functor never sees a default value
+	const node* cur = _root;
+	_tvalue prefix = _tvalue();
+	bool found = false;
+
+	while(cur->left() != nullptr) {
+		_tvalue joined = found ? _func(prefix, cur->left()->value()) : cur->left()->value();
+
+		if(predicate(joined)) cur = cur->left();
+		else {
+			prefix = joined;
+			found = true;
+			cur = cur->right();
+		}
+	}
 
-	// Range extension
-	std::pair<_tindex, _tindex> range;
+	index = key<_tindex>::decode(cur->range().first);
+	return true;
+}
 
-	if(cur->parent() == nullptr) { // Very unfortunate, we extend manually
-		range = cur->range();
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+template<class _function>
+void tree<_tvalue, _tindex, _functor, _flat>::for_each(const _tindex& start, const _tindex& end, _function function) const {
+	_visit(_root, std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end)), function);
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+template<class _function>
+void tree<_tvalue, _tindex, _functor, _flat>::parallel_for_each(const _tindex& start, const _tindex& end, _function function,
+	thread_pool& pool, order visit) const {
 
-		_tindex dist = (index < range.first) ? range.second - index : index - range.first;
-		_tindex resolution = 1;
+	std::pair<_tkey, _tkey> segment = std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end));
+	std::vector<const node*> pieces;
+	std::vector<std::size_t> bounds;
 
-		while(resolution > dist) resolution /= 2;
+	_partition(segment, pool, pieces, bounds);
+	std::size_t parts = bounds.size() - 1;
 
-		if(index < range.first) { // Left extension
-			while(resolution < dist) resolution *= 2;
-			range.first = range.second - resolution;
+	if(visit == unordered) {
+		std::vector<std::future<void>> tasks;
 
-			// That weird single-element interval case
-			if(cur->range().first == cur->range().second) range.second += resolution;
+		for(std::size_t part = 0; part < parts; ++part) {
+			tasks.push_back(pool.submit([this, &pieces, &bounds, &segment, &function, part] {
+				for(std::size_t i = bounds[part]; i < bounds[part + 1]; ++i) _visit(pieces[i], segment, function);
+			}));
 		}
-		else { // Right extension
-			while(resolution <= dist) resolution *= 2;
-			range.second = range.first + resolution;
+
+		// Every task is waited for before rethrowing, since they refer to the locals
+		std::exception_ptr error;
+
+		for(std::future<void>& task : tasks) {
+			try { pool.wait(task); }
+			catch(...) { if(!error) error = std::current_exception(); }
 		}
+
+		if(error) std::rethrow_exception(error);
+		return;
 	}
-	else { // We could just shrink the parent's range
-		range = cur->parent()->range();
-
-		while(true) {
-			auto mid = range.first + (range.second - range.first) / 2;
-			auto l = cur->range().first, r = cur->range().second;
-
-			if(index < mid) {
-				if(l >= mid) break;
-				range.second = mid;
-			}
-			else {
-				// That weird single-element interval case again
-				if(l == r) {
-					if(r < mid) break;
-				}
-				else if(r <= mid) break;
-				range.first = mid;
-			}
+
+	using _tentries = std::vector<std::pair<_tindex, _tvalue>>;
+
+	auto gather = [this, &pieces, &bounds, &segment](std::size_t part) {
+		_tentries entries;
+		auto push = [&entries](const _tindex& index, const _tvalue& value) { entries.emplace_back(index, value); };
+
+		for(std::size_t i = bounds[part]; i < bounds[part + 1]; ++i) _visit(pieces[i], segment, push);
+		return entries;
+	};
+
+	// A window of parts is gathered ahead of the calls, which bounds the memory held by the entries
+	std::size_t window = 2 * pool.size();
+	std::vector<std::future<_tentries>> tasks(parts);
+	std::size_t submitted = 0, part = 0;
+
+	try {
+		for(; part < parts; ++part) {
+			for(; submitted < parts && submitted < part + window; ++submitted)
+				tasks[submitted] = pool.submit([&gather, submitted] { return gather(submitted); });
+
+			for(const std::pair<_tindex, _tvalue>& entry : pool.wait(tasks[part])) function(entry.first, entry.second);
+		}
+	}
+	catch(...) {
+		// The parts still running refer to the locals, and are waited for through the pool, which may be the caller's own.
+		// A part already waited for is no longer valid, and the exceptions of the others are dropped for the first one.
+		for(; part < submitted; ++part) {
+			if(!tasks[part].valid()) continue;
+
+			try { pool.wait(tasks[part]); }
+			catch(...) {}
 		}
+
+		throw;
 	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+template<class _iterator>
+void tree<_tvalue, _tindex, _functor, _flat>::batch(_iterator first, _iterator last) {
+	std::vector<_tentry> entries;
+	for(; first != last; ++first) entries.emplace_back(key<_tindex>::encode(first->index), &*first);
+	if(entries.empty()) return;
+
+	std::stable_sort(entries.begin(), entries.end(), [](const _tentry& a, const _tentry& b) { return a.first < b.first; });
+
+	_root = _batch(_root, entries.data(), entries.data() + entries.size());
+	if(_root != nullptr) _root->parent() = nullptr;
+	++_version;
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+template<class _iterator>
+void tree<_tvalue, _tindex, _functor, _flat>::build(_iterator first, _iterator last) {
+	_assign(first, last, nullptr);
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+template<class _iterator>
+void tree<_tvalue, _tindex, _functor, _flat>::build(_iterator first, _iterator last, thread_pool& pool) {
+	_assign(first, last, &pool);
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::clear() {
+	_clear(_root);
+	_root = nullptr;
+	++_version;
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+typename tree<_tvalue, _tindex, _functor, _flat>::node*
+tree<_tvalue, _tindex, _functor, _flat>::_extend(node* cur, const _tkey& index) {
+
+	// Range extension, the index and the node differ first at the bit splitting the new block
+	_tkey mask = bit::block(cur->range().first, index);
+	std::pair<_tkey, _tkey> range = std::make_pair(_tkey(index & ~mask), _tkey(index | mask));
 
 	// Node creation and initialization
 	node* par = new node(range);
@@ -333,12 +868,13 @@ tree<_tvalue, _tindex, _functor>::_extend(node* cur, const _tindex& index) {
 		par->right() = nullptr;
 	}
 
+	cur->parent() = par;
 	return par;
 }
 
-template<typename _tvalue, typename _tindex, class _functor>
-typename tree<_tvalue, _tindex, _functor>::node*
-tree<_tvalue, _tindex, _functor>::_insert(node* cur, const _tindex& index, const _tvalue& value) {
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+typename tree<_tvalue, _tindex, _functor, _flat>::node*
+tree<_tvalue, _tindex, _functor, _flat>::_insert(node* cur, const _tkey& index, const _tvalue& value) {
 	if(cur == nullptr) {
 		cur = new node(index, value);
 		if(_root == nullptr) _root = cur;
@@ -346,22 +882,17 @@ tree<_tvalue, _tindex, _functor>::_insert(node* cur, const _tindex& index, const
 	}
 
 	auto range = cur->range();
-	auto mid = range.first + (range.second - range.first) / 2;
 
-	if(range.first == range.second) { // Collided?
-		if(range.first == index) { // Great, update the value
-			cur->value() = value;
-			return cur;
-		}
-	}
+	if(index < range.first || range.second < index) // Outside? Better call extend
+		return _insert(_extend(cur, index), index, value);
 
-	if(index < range.first || index >= range.second) { // Outside? Better call extend
-		node* par = _extend(cur, index);
-		cur->parent() = par;
-		return _insert(par, index, value);
+	if(range.first == range.second) { // Collided, update the value
+		cur->value() = value;
+		return cur;
 	}
 
-	auto& branch = (index < mid) ? cur->left() : cur->right();
+	auto mid = range.first + (range.second - range.first) / 2;
+	auto& branch = (index <= mid) ? cur->left() : cur->right();
 	branch = _insert(branch, index, value);
 	branch->parent() = cur;
 
@@ -369,30 +900,28 @@ tree<_tvalue, _tindex, _functor>::_insert(node* cur, const _tindex& index, const
 	return cur;
 }
 
-template <typename _tvalue, typename _tindex, class _functor>
-typename tree<_tvalue, _tindex, _functor>::node*
-tree<_tvalue, _tindex, _functor>::_apply(node* cur, const _tindex& index, const _tvalue& value) {
+template <typename _tvalue, typename _tindex, class _functor, bool _flat>
+typename tree<_tvalue, _tindex, _functor, _flat>::node*
+tree<_tvalue, _tindex, _functor, _flat>::_apply(node* cur, const _tkey& index, const _tvalue& value) {
 	// Almost copy-pasted implementation from insert
-    if(cur == nullptr) {
+	if(cur == nullptr) {
 		cur = new node(index, value);
 		if(_root == nullptr) _root = cur;
 		return cur;
 	}
 
 	auto range = cur->range();
-	auto mid = range.first + (range.second - range.first) / 2;
 
-	if(range.first == range.second) { // Collided?
-		if(range.first == index) { // Great, apply the value
-			cur->value() = _func(cur->value(), value);
-			return cur;
-		}
+	if(index < range.first || range.second < index) // Outside? Better call insert
+		return _insert(cur, index, value);
+
+	if(range.first == range.second) { // Collided, apply the value
+		cur->value() = _func(cur->value(), value);
+		return cur;
 	}
 
-	if(index < range.first || index >= range.second) // Outside? Better call insert
-		return _insert(cur, index, value);
-	
-	auto& branch = (index < mid) ? cur->left() : cur->right();
+	auto mid = range.first + (range.second - range.first) / 2;
+	auto& branch = (index <= mid) ? cur->left() : cur->right();
 	branch = _apply(branch, index, value);
 	branch->parent() = cur;
 
@@ -400,30 +929,30 @@ tree<_tvalue, _tindex, _functor>::_apply(node* cur, const _tindex& index, const
 	return cur;
 }
 
-template<typename _tvalue, typename _tindex, class _functor>
-typename tree<_tvalue, _tindex, _functor>::node*
-tree<_tvalue, _tindex, _functor>::_erase(node* cur, const _tindex& index) {
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+typename tree<_tvalue, _tindex, _functor, _flat>::node*
+tree<_tvalue, _tindex, _functor, _flat>::_erase(node* cur, const _tkey& index) {
 	if(cur == nullptr) return nullptr;
 	
 	auto range = cur->range();
-	auto mid = range.first + (range.second - range.first) / 2;
 
-	if(range.first == range.second) {
-		if(range.first == index) { // Only erase if found
-			if(cur == _root) _root = nullptr;
-			delete cur;
-			cur = nullptr;
-		}
-		return cur;
+	if(index < range.first || range.second < index) return cur; // Not in the tree
+
+	if(range.first == range.second) { // Only erase if found
+		if(cur == _root) _root = nullptr;
+		delete cur;
+		return nullptr;
 	}
 
-	if(index < mid) cur->left() = _erase(cur->left(), index);
+	auto mid = range.first + (range.second - range.first) / 2;
+
+	if(index <= mid) cur->left() = _erase(cur->left(), index);
 	else cur->right() = _erase(cur->right(), index);
 
 	if(!cur->left() ^ !cur->right()) { // Prune the excessive parent
 		node* child = (cur->left() == nullptr) ? cur->right() : cur->left();
+		child->parent() = cur->parent();
 		if(cur == _root) _root = child;
-		else child->parent() = cur->parent();
 
 		delete cur;
 		return child;
@@ -433,30 +962,191 @@ tree<_tvalue, _tindex, _functor>::_erase(node* cur, const _tindex& index) {
 	return cur;
 }
 
-template<typename _tvalue, typename _tindex, class _functor>
-_tvalue tree<_tvalue, _tindex, _functor>::_query(node* cur, const std::pair<_tindex, _tindex>& segment) const {
-	if(cur == nullptr) return _tvalue();
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::_query(const node* cur, const std::pair<_tkey, _tkey>& segment) const {
+	_tvalue result = _tvalue();
+	bool found = false;
+
+	_query(cur, segment, result, found);
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::_query(const node* cur, const std::pair<_tkey, _tkey>& segment, _tvalue& result,
+	bool& found) const {
+
+	if(cur == nullptr) return;
 
 	auto range = cur->range();
+
+	if(segment.first <= range.first && range.second <= segment.second) {
+		result = found ? _func(result, cur->value()) : cur->value();
+		found = true;
+		return;
+	}
+
+	if(segment.second < range.first || range.second < segment.first || range.first == range.second)
+		return;
+
 	auto mid = range.first + (range.second - range.first) / 2;
 
-	if(segment.first <= range.first && range.second <= segment.second)
-		return cur->value();
+	if(segment.first <= mid) _query(cur->left(), segment, result, found);
+	if(mid < segment.second) _query(cur->right(), segment, result, found);
+}
 
-	if(segment.first < mid && mid <= segment.second)
-		return _func(_query(cur->left(), segment), _query(cur->right(), segment));
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::_cover(const node* cur, const std::pair<_tkey, _tkey>& segment,
+	std::vector<const node*>& cover) const {
 
-	if(segment.second < mid)
-		return _query(cur->left(), segment);
+	if(cur == nullptr) return;
 
-	if(mid <= segment.first)
-		return _query(cur->right(), segment);
+	auto range = cur->range();
+
+	if(segment.first <= range.first && range.second <= segment.second) {
+		cover.push_back(cur);
+		return;
+	}
+
+	if(segment.second < range.first || range.second < segment.first || range.first == range.second)
+		return;
 
-	return _tvalue();
+	auto mid = range.first + (range.second - range.first) / 2;
+
+	if(segment.first <= mid) _cover(cur->left(), segment, cover);
+	if(mid < segment.second) _cover(cur->right(), segment, cover);
 }
 
-template<typename _tvalue, typename _tindex, class _functor>
-void tree<_tvalue, _tindex, _functor>::_clear(node* cur) {
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::_fold(const node* const* first, const node* const* last) const {
+	if(first == last) return _tvalue();
+
+	_tvalue result = (*first)->value();
+	for(++first; first != last; ++first) result = _func(result, (*first)->value());
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+template<class _function>
+void tree<_tvalue, _tindex, _functor, _flat>::_visit(const node* cur, const std::pair<_tkey, _tkey>& segment, _function& function) const {
+	if(cur == nullptr) return;
+
+	auto range = cur->range();
+	if(segment.second < range.first || range.second < segment.first) return;
+
+	if(range.first == range.second) {
+		function(key<_tindex>::decode(range.first), cur->value());
+		return;
+	}
+
+	_visit(cur->left(), segment, function);
+	_visit(cur->right(), segment, function);
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+std::size_t tree<_tvalue, _tindex, _functor, _flat>::_count(const node* cur) {
+	if(cur == nullptr) return 0;
+	if(cur->left() == nullptr && cur->right() == nullptr) return 1;
+
+	return _count(cur->left()) + _count(cur->right());
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+std::size_t tree<_tvalue, _tindex, _functor, _flat>::_count(const node* cur,
+	std::vector<std::pair<const node*, std::size_t>>& sizes, std::size_t& floor, std::size_t limit) {
+
+	if(cur == nullptr) return 0;
+	if(cur->left() == nullptr && cur->right() == nullptr) return 1;
+
+	std::size_t result = _count(cur->left(), sizes, floor, limit) + _count(cur->right(), sizes, floor, limit);
+	if(result < floor) return result;
+
+	sizes.emplace_back(cur, result);
+
+	if(sizes.size() > limit) {
+		floor *= 2;
+		sizes.erase(std::remove_if(sizes.begin(), sizes.end(),
+			[floor](const std::pair<const node*, std::size_t>& size) { return size.second < floor; }), sizes.end());
+	}
+
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::_partition(const std::pair<_tkey, _tkey>& segment, thread_pool& pool,
+	std::vector<const node*>& pieces, std::vector<std::size_t>& bounds) const {
+
+	_cover(_root, segment, pieces);
+
+	using _tsize = std::pair<const node*, std::size_t>;
+	std::vector<std::vector<_tsize>> sizes(pieces.size());
+	std::vector<std::future<std::size_t>> counts;
+
+	for(std::size_t i = 0; i < pieces.size(); ++i) {
+		const node* cur = pieces[i];
+		std::vector<_tsize>* kept = &sizes[i];
+		std::size_t limit = 64 * pool.size();
+
+		counts.push_back(pool.submit([cur, kept, limit] {
+			std::size_t floor = 2;
+			return _count(cur, *kept, floor, limit);
+		}));
+	}
+
+	std::vector<std::size_t> leaves;
+	std::size_t total = 0;
+
+	for(std::future<std::size_t>& count : counts) {
+		leaves.push_back(pool.wait(count));
+		total += leaves.back();
+	}
+
+	// The kept sizes are looked up by node, the subtrees left out being small enough to be counted again
+	std::vector<_tsize> known;
+	for(const std::vector<_tsize>& kept : sizes) known.insert(known.end(), kept.begin(), kept.end());
+	std::sort(known.begin(), known.end(), [](const _tsize& a, const _tsize& b) { return std::less<const node*>()(a.first, b.first); });
+
+	auto size = [&known](const node* cur) {
+		auto found = std::lower_bound(known.begin(), known.end(), cur,
+			[](const _tsize& a, const node* b) { return std::less<const node*>()(a.first, b); });
+		return (found != known.end() && found->first == cur) ? found->second : _count(cur);
+	};
+
+	// Split the heaviest subtree until none holds more than a share of the leaves
+	std::size_t piece = std::max<std::size_t>(1, total / (8 * pool.size()));
+
+	while(true) {
+		std::size_t heaviest = 0;
+		for(std::size_t i = 1; i < pieces.size(); ++i) if(leaves[heaviest] < leaves[i]) heaviest = i;
+
+		if(pieces.empty() || leaves[heaviest] <= piece || leaves[heaviest] == 1) break;
+
+		const node* cur = pieces[heaviest];
+		std::size_t left = size(cur->left());
+
+		pieces[heaviest] = cur->right();
+		leaves[heaviest] -= left;
+		pieces.insert(pieces.begin() + heaviest, cur->left());
+		leaves.insert(leaves.begin() + heaviest, left);
+	}
+
+	// Group consecutive pieces into parts of about the same amount of leaves
+	std::size_t share = std::max<std::size_t>(1, total / (4 * pool.size())), sum = 0;
+	bounds.push_back(0);
+
+	for(std::size_t i = 0; i < pieces.size(); ++i) {
+		sum += leaves[i];
+
+		if(sum >= share && i + 1 < pieces.size()) {
+			bounds.push_back(i + 1);
+			sum = 0;
+		}
+	}
+
+	bounds.push_back(pieces.size());
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::_clear(node* cur) {
 	if(cur == nullptr) return;
 	_clear(cur->left());
 	_clear(cur->right());
@@ -465,6 +1155,232 @@ void tree<_tvalue, _tindex, _functor>::_clear(node* cur) {
 	cur = nullptr;
 }
 
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::_refresh(node* cur) {
+	for(cur = cur->parent(); cur != nullptr; cur = cur->parent())
+		cur->value() = _func(cur->left()->value(), cur->right()->value());
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+typename tree<_tvalue, _tindex, _functor, _flat>::node*
+tree<_tvalue, _tindex, _functor, _flat>::_batch(node* cur, const _tentry* first, const _tentry* last) {
+	if(first == last) return cur;
+
+	// Empty subtree, start from the first key that remains after its operations
+	while(cur == nullptr && first != last) {
+		const _tentry* group = first;
+		while(group != last && group->first == first->first) ++group;
+
+		bool present = false;
+		_tvalue value = _tvalue();
+		_resolve(first, group, present, value);
+
+		if(present) cur = new node(first->first, value);
+		first = group;
+	}
+
+	if(first == last) return cur;
+
+	auto range = cur->range();
+	_tkey low = first->first, high = (last - 1)->first;
+
+	if(low < range.first || range.second < high) { // Extend once for the whole batch
+		_tkey mask = 0;
+		if(low < range.first) mask |= bit::block(range.first, low);
+		if(range.second < high) mask |= bit::block(range.first, high);
+
+		node* par = new node(std::make_pair(_tkey(range.first & ~mask), _tkey(range.first | mask)));
+		auto mid = _tkey(range.first & ~mask) + mask / 2;
+
+		if(range.first <= mid) par->left() = cur;
+		else par->right() = cur;
+
+		cur->parent() = par;
+		cur = par;
+		range = cur->range();
+	}
+
+	if(range.first == range.second) { // Every operation is on this leaf
+		bool present = true;
+		_resolve(first, last, present, cur->value());
+
+		if(present) return cur;
+
+		delete cur;
+		return nullptr;
+	}
+
+	auto mid = range.first + (range.second - range.first) / 2;
+	const _tentry* split = std::partition_point(first, last, [mid](const _tentry& entry) { return entry.first <= mid; });
+
+	cur->left() = _batch(cur->left(), first, split);
+	cur->right() = _batch(cur->right(), split, last);
+
+	if(cur->left() == nullptr || cur->right() == nullptr) { // Prune the excessive parent
+		node* child = (cur->left() == nullptr) ? cur->right() : cur->left();
+		delete cur;
+		return child;
+	}
+
+	cur->left()->parent() = cur;
+	cur->right()->parent() = cur;
+	cur->value() = _func(cur->left()->value(), cur->right()->value());
+	return cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::_resolve(const _tentry* first, const _tentry* last, bool& present, _tvalue& value) const {
+	for(; first != last; ++first) {
+		const operation& cur = *first->second;
+
+		if(cur.type == operation::erase) present = false;
+		else {
+			value = (cur.type == operation::apply && present) ? _func(value, cur.value) : cur.value;
+			present = true;
+		}
+	}
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+template<class _iterator>
+void tree<_tvalue, _tindex, _functor, _flat>::_assign(_iterator first, _iterator last, thread_pool* pool) {
+	std::vector<_tpair> entries;
+	for(; first != last; ++first) entries.emplace_back(key<_tindex>::encode(first->first), first->second);
+
+	auto less = [](const _tpair& a, const _tpair& b) { return a.first < b.first; };
+	if(!std::is_sorted(entries.begin(), entries.end(), less)) std::stable_sort(entries.begin(), entries.end(), less);
+
+	// Keep the last value of every key
+	std::size_t kept = 0;
+
+	for(std::size_t i = 0; i < entries.size(); ++i) {
+		if(kept > 0 && entries[kept - 1].first == entries[i].first) entries[kept - 1].second = std::move(entries[i].second);
+		else if(kept++ != i) entries[kept - 1] = std::move(entries[i]);
+	}
+
+	entries.resize(kept);
+	clear();
+
+	if(!entries.empty()) _root = _build(entries.data(), entries.data() + entries.size(), pool);
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+typename tree<_tvalue, _tindex, _functor, _flat>::node*
+tree<_tvalue, _tindex, _functor, _flat>::_build(const _tpair* first, const _tpair* last, thread_pool* pool) const {
+	if(last - first == 1) return new node(first->first, first->second);
+
+	// The node is the smallest aligned block holding every key, which splits them at its middle
+	_tkey mask = bit::block(first->first, (last - 1)->first);
+	std::pair<_tkey, _tkey> range = std::make_pair(_tkey(first->first & ~mask), _tkey(first->first | mask));
+
+	auto mid = range.first + (range.second - range.first) / 2;
+	const _tpair* split = std::partition_point(first, last, [mid](const _tpair& entry) { return entry.first <= mid; });
+
+	node *left, *right;
+
+	if(pool != nullptr && std::size_t(last - first) > _grain) {
+		auto task = pool->submit([this, first, split, pool] { return _build(first, split, pool); });
+		right = _build(split, last, pool);
+		left = pool->wait(task);
+	}
+	else {
+		left = _build(first, split, pool);
+		right = _build(split, last, pool);
+	}
+
+	node* cur = new node(range, _func(left->value(), right->value()), nullptr, left, right);
+	left->parent() = cur;
+	right->parent() = cur;
+	return cur;
+}
+
+/**
+ ******************************************* Finger methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+tree<_tvalue, _tindex, _functor, _flat>::finger::finger(tree& owner)
+	: _tree(&owner), _node(owner._root), _version(owner._version) {}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::finger::insert(const _tindex& index, const _tvalue& value) {
+	_tkey target = key<_tindex>::encode(index);
+	node* cur = _tree->_insert(_climb(target, target), target, value);
+
+	_tree->_refresh(cur);
+	_settle(cur, target);
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::finger::apply(const _tindex& index, const _tvalue& value) {
+	_tkey target = key<_tindex>::encode(index);
+	node* cur = _tree->_apply(_climb(target, target), target, value);
+
+	_tree->_refresh(cur);
+	_settle(cur, target);
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::finger::query(const _tindex& start, const _tindex& end) {
+	std::pair<_tkey, _tkey> segment = std::make_pair(key<_tindex>::encode(start), key<_tindex>::encode(end));
+	node* cur = _climb(segment.first, segment.second);
+
+	_tvalue result = _tree->_query(cur, segment);
+	_settle(cur, segment.first);
+	return result;
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::finger::query(const std::pair<_tindex, _tindex>& range) {
+	return query(range.first, range.second);
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+_tvalue tree<_tvalue, _tindex, _functor, _flat>::finger::operator[](const _tindex& index) {
+	_tkey target = key<_tindex>::encode(index);
+	_settle(_climb(target, target), target);
+
+	if(_node == nullptr || _node->range().first != target || _node->range().second != target) return _tvalue();
+	return _node->value();
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+typename tree<_tvalue, _tindex, _functor, _flat>::node*
+tree<_tvalue, _tindex, _functor, _flat>::finger::_climb(const _tkey& first, const _tkey& last) {
+	if(_node == nullptr || _version != _tree->_version) { // Lost, start over from the root
+		_node = _tree->_root;
+		_version = _tree->_version;
+	}
+
+	node* cur = _node;
+	if(cur == nullptr) return _tree->_root;
+
+	while(cur->parent() != nullptr && (first < cur->range().first || cur->range().second < last))
+		cur = cur->parent();
+
+	return cur;
+}
+
+template<typename _tvalue, typename _tindex, class _functor, bool _flat>
+void tree<_tvalue, _tindex, _functor, _flat>::finger::_settle(node* cur, const _tkey& index) {
+	while(cur != nullptr && cur->range().first != cur->range().second) {
+		auto range = cur->range();
+		if(index < range.first || range.second < index) break;
+
+		auto mid = range.first + (range.second - range.first) / 2;
+		cur = (index <= mid) ? cur->left() : cur->right();
+	}
+
+	_node = cur;
+}
+
+/**
+ ************************************* Small universe specializations *************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+class tree<_tvalue, _tindex, _functor, true> : public flat_tree<_tvalue, _tindex, _functor> {};
+
 }
 
-#endif
\ No newline at end of file
+#endif
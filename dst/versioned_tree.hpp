@@ -0,0 +1,204 @@
+/**
+ * @file versioned_tree.hpp
+ * @brief Implementation of the persistent dynamic segment tree, queried as of any past version.
+ */
+
+#ifndef DST_VERSIONED_TREE_HPP_
+#define DST_VERSIONED_TREE_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "snapshot_tree.hpp"
+
+namespace dst {
+
+/**
+ * @brief The versioned tree, a persistent tree keeping every version it went through.
+ *
+ * Every modification creates a new version, numbered from 0 for the empty tree on, whose root is kept as a view of
+ * snapshot_tree in an array indexed by version. A write thus copies the path from the root to its index, since the previous
+ * version still holds it, and shares every other node with the versions before, so that each version costs the memory of
+ * one path. Any past version is then queried in the time of a query on the current one, without rebuilding anything.
+ *
+ * Only the latest version is modified, the older ones being read only. Modifications must not run concurrently with any
+ * other call, as in tree.
+ *
+ * @tparam _tvalue The type of the values stored in the tree indices.
+ * @tparam _tindex The type of the indices used in the tree, with the same requirements as in tree.
+ * @tparam _functor The functor used to aggregate the values of the tree. Default to std::plus<_tvalue>.
+ */
+template<typename _tvalue, typename _tindex, class _functor = std::plus<_tvalue>>
+class versioned_tree {
+public:
+	/**
+	 * @brief An immutable version of the tree.
+	 */
+	using view = typename snapshot_tree<_tvalue, _tindex, _functor>::view;
+
+	/**
+	 * @brief Constructor for the tree, at version 0 which is empty.
+	 */
+	versioned_tree();
+
+	/**
+	 * @brief Insert a value at a given index in the tree, creating a new version.
+	 * @param index The index to insert the value.
+	 * @param value The value to insert.
+	 * @return The new version.
+	 */
+	std::size_t insert(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Aggregate a value to a given index in the tree, creating a new version.
+	 * @param index The index to apply the value on.
+	 * @param value The value to apply.
+	 * @return The new version.
+	 */
+	std::size_t apply(const _tindex& index, const _tvalue& value);
+
+	/**
+	 * @brief Remove an index (with its value) from the tree, creating a new version.
+	 * @param index The index to be removed.
+	 * @return The new version.
+	 */
+	std::size_t erase(const _tindex& index);
+
+	/**
+	 * @brief The current version, which is the amount of modifications so far.
+	 */
+	std::size_t version() const;
+
+	/**
+	 * @brief Aggregate the values in the given range in the current version. The range is inclusive.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range.
+	 */
+	_tvalue query(const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Aggregate the values in the given range as of a past version. The range is inclusive.
+	 * @param version The version to query, at most the current one.
+	 * @param start The start of the range to query.
+	 * @param end The end of the range to query.
+	 * @return The aggregate value of the range in the version.
+	 */
+	_tvalue query_at(std::size_t version, const _tindex& start, const _tindex& end) const;
+
+	/**
+	 * @brief Access the value at a given index as of a past version.
+	 * @param version The version to access, at most the current one.
+	 * @param index The index to access.
+	 * @return The value at the index in the version.
+	 */
+	_tvalue at(std::size_t version, const _tindex& index) const;
+
+	/**
+	 * @brief Access the value at a given index in the current version.
+	 * @param index The index to access.
+	 * @return The value at the index.
+	 */
+	_tvalue operator[](const _tindex& index) const;
+
+	/**
+	 * @brief Give a view of a past version, which stays valid after the tree is destroyed.
+	 * @param version The version, at most the current one.
+	 * @return The view of the version.
+	 */
+	view snapshot(std::size_t version) const;
+
+private:
+	/**
+	 * @brief The tree holding the current version.
+	 */
+	snapshot_tree<_tvalue, _tindex, _functor> _tree;
+
+	/**
+	 * @brief The root of every version, by version.
+	 */
+	std::vector<view> _versions;
+
+	/**
+	 * @brief Internal function to record the current version of the tree.
+	 * @return The new version.
+	 */
+	std::size_t _commit();
+};
+
+/**
+ ************************************** Special member functions **************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+versioned_tree<_tvalue, _tindex, _functor>::versioned_tree() {
+	_versions.push_back(_tree.snapshot());
+}
+
+/**
+ ******************************************* Public methods *******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t versioned_tree<_tvalue, _tindex, _functor>::insert(const _tindex& index, const _tvalue& value) {
+	_tree.insert(index, value);
+	return _commit();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t versioned_tree<_tvalue, _tindex, _functor>::apply(const _tindex& index, const _tvalue& value) {
+	_tree.apply(index, value);
+	return _commit();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t versioned_tree<_tvalue, _tindex, _functor>::erase(const _tindex& index) {
+	_tree.erase(index);
+	return _commit();
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t versioned_tree<_tvalue, _tindex, _functor>::version() const {
+	return _versions.size() - 1;
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue versioned_tree<_tvalue, _tindex, _functor>::query(const _tindex& start, const _tindex& end) const {
+	return _tree.query(start, end);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue versioned_tree<_tvalue, _tindex, _functor>::query_at(std::size_t version, const _tindex& start, const _tindex& end) const {
+	return _versions[version].query(start, end);
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue versioned_tree<_tvalue, _tindex, _functor>::at(std::size_t version, const _tindex& index) const {
+	return _versions[version][index];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+_tvalue versioned_tree<_tvalue, _tindex, _functor>::operator[](const _tindex& index) const {
+	return _tree[index];
+}
+
+template<typename _tvalue, typename _tindex, class _functor>
+typename versioned_tree<_tvalue, _tindex, _functor>::view versioned_tree<_tvalue, _tindex, _functor>::snapshot(std::size_t version) const {
+	return _versions[version];
+}
+
+/**
+ ******************************************* Private methods ******************************************
+ */
+
+template<typename _tvalue, typename _tindex, class _functor>
+std::size_t versioned_tree<_tvalue, _tindex, _functor>::_commit() {
+	_versions.push_back(_tree.snapshot());
+	return _versions.size() - 1;
+}
+
+}
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * @file adaptive.cpp
+ * @brief Example of adaptive_tree use on Salary Queries (https://cses.fi/problemset/task/1144/), whose salaries crowd
+ * into a few dense blocks while the rest of the range stays sparse.
+ */
+
+#include <iostream>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	std::ios_base::sync_with_stdio(false);
+	std::cin.tie(nullptr);
+
+	int size, query;
+	std::cin >> size >> query;
+
+	std::vector<int> arr(size);
+	dst::adaptive_tree<int, int> tree;
+
+	for(int& value : arr) {
+		std::cin >> value;
+		tree.apply(value, 1);
+	}
+
+	while(query--) {
+		char type;
+		std::cin >> type;
+
+		if(type == '?') {
+			int start, end;
+			std::cin >> start >> end;
+			std::cout << tree.query(start, end) << '\n';
+		}
+		else {
+			int employee, salary;
+			std::cin >> employee >> salary;
+			--employee;
+
+			tree.apply(arr[employee], -1);
+			tree.apply(salary, 1);
+			arr[employee] = salary;
+		}
+	}
+}
@@ -0,0 +1,31 @@
+/**
+ * @file atomic.cpp
+ * @brief Example of atomic_tree use: threads claiming identifiers, the first one to insert winning, and counting events.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	dst::atomic_tree<long long, long long> events;
+	std::atomic<int> claimed(0);
+
+	std::vector<std::thread> workers;
+	for(int id = 0; id < 4; ++id) {
+		workers.emplace_back([&events, &claimed, id] {
+			for(long long user = 0; user < 10000; ++user) {
+				// Every worker tries to register each user, only one of them succeeds
+				if(events.insert(user << 32, id)) claimed.fetch_add(1);
+				events.apply((user << 32) | 1, 1);
+			}
+		});
+	}
+
+	for(std::thread& worker : workers) worker.join();
+
+	std::cout << "claimed: " << claimed.load() << '\n';
+	std::cout << "events of user 42: " << events[(42ll << 32) | 1] << '\n';
+}
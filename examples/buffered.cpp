@@ -0,0 +1,30 @@
+/**
+ * @file buffered.cpp
+ * @brief Example of buffered_tree use: threads buffering their deltas, and queries choosing whether to see them all.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	using tree = dst::buffered_tree<long long, int>;
+
+	// Each thread merges its buffer once it holds 256 indices, or 10 milliseconds after its last merge
+	tree clicks(256, std::chrono::milliseconds(10));
+
+	std::vector<std::thread> writers;
+	for(int id = 0; id < 4; ++id) {
+		writers.emplace_back([&clicks, id] {
+			for(int click = 0; click < 100000; ++click) clicks.apply((click * 13 + id) % 5000, 1);
+		});
+	}
+
+	for(std::thread& writer : writers) writer.join();
+
+	// The merged level may miss the deltas still buffered, the flushed level merges them first
+	std::cout << "merged: " << clicks.query(0, 4999) << '\n';
+	std::cout << "flushed: " << clicks.query(0, 4999, tree::flushed) << '\n';
+}
@@ -0,0 +1,25 @@
+/**
+ * @file combining.cpp
+ * @brief Example of combining_tree use: many threads adding to a few hot indices, their updates combined in batches.
+ */
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	dst::combining_tree<long long, int> votes;
+
+	std::vector<std::thread> voters;
+	for(int id = 0; id < 8; ++id) {
+		voters.emplace_back([&votes, id] {
+			for(int vote = 0; vote < 50000; ++vote) votes.apply((vote + id) % 3, 1);
+		});
+	}
+
+	for(std::thread& voter : voters) voter.join();
+
+	for(int candidate = 0; candidate < 3; ++candidate)
+		std::cout << "candidate " << candidate << ": " << votes[candidate] << '\n';
+}
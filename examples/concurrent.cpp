@@ -0,0 +1,32 @@
+/**
+ * @file concurrent.cpp
+ * @brief Example of concurrent_tree use: threads tallying the hits of pages while another one reports the busiest range.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	dst::concurrent_tree<long long, int> hits;
+	std::atomic<bool> done(false);
+
+	std::vector<std::thread> servers;
+	for(int id = 0; id < 4; ++id) {
+		servers.emplace_back([&hits, id] {
+			for(int request = 0; request < 100000; ++request) hits.apply((request * 7 + id) % 1000, 1);
+		});
+	}
+
+	std::thread report([&hits, &done] {
+		while(!done.load()) std::cout << "pages 0-99 so far: " << hits.query(0, 99) << '\n';
+	});
+
+	for(std::thread& server : servers) server.join();
+	done.store(true);
+	report.join();
+
+	std::cout << "total: " << hits.query(0, 999) << '\n';
+}
@@ -0,0 +1,27 @@
+/**
+ * @file counter.cpp
+ * @brief Example of counter_tree use: lock-free counters of requests by status code, with ranges of codes summed.
+ */
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	dst::counter_tree<long long, int> status;
+	for(int code : {200, 301, 404, 500}) status.insert(code, 0);
+
+	std::vector<std::thread> servers;
+	for(int id = 0; id < 4; ++id) {
+		servers.emplace_back([&status, id] {
+			const int codes[] = {200, 200, 200, 301, 404, 500};
+			for(int request = 0; request < 100000; ++request) status.apply(codes[(request + id) % 6], 1);
+		});
+	}
+
+	for(std::thread& server : servers) server.join();
+
+	std::cout << "success: " << status.query(200, 299) << '\n';
+	std::cout << "errors: " << status.query(400, 599) << '\n';
+}
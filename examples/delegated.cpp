@@ -0,0 +1,34 @@
+/**
+ * @file delegated.cpp
+ * @brief Example of delegated_tree use: threads sending their updates to the owner thread, and waiting on queries.
+ */
+
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	dst::delegated_tree<long long, int> stock;
+
+	std::vector<std::thread> stores;
+	for(int id = 0; id < 4; ++id) {
+		stores.emplace_back([&stock, id] {
+			for(int sale = 0; sale < 10000; ++sale) stock.apply(id * 100 + sale % 100, -1);
+		});
+	}
+
+	for(std::thread& store : stores) store.join();
+
+	// Queries are answered by the owner thread, either through a future or a callback run there
+	std::future<long long> sold = stock.query(0, 399);
+	std::cout << "sold: " << -sold.get() << '\n';
+
+	std::promise<void> printed;
+	stock.query(100, 199, [&printed](const long long& value) {
+		std::cout << "sold by store 1: " << -value << '\n';
+		printed.set_value();
+	});
+	printed.get_future().wait();
+}
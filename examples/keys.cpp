@@ -0,0 +1,39 @@
+/**
+ * @file keys.cpp
+ * @brief Example of tree use with indices other than machine integers: floating points, pairs and 128-bit integers.
+ */
+
+#include <iostream>
+#include <utility>
+#include "dst.hpp"
+
+int main() {
+	// Prices as floating point indices, ordered as numbers including the negative ones
+	dst::tree<int, double> prices;
+	prices.apply(9.99, 3);
+	prices.apply(-0.5, 1);
+	prices.apply(12.25, 2);
+	std::cout << "orders under 10: " << prices.query(-1e9, 10.0) << '\n';
+
+	// Cells of a grid as pairs, ordered by row then column
+	dst::tree<long long, std::pair<int, int>> grid;
+	grid.insert({2, 5}, 10);
+	grid.insert({2, 7}, 20);
+	grid.insert({3, 0}, 40);
+	std::cout << "row 2: " << grid.query({2, -1000000}, {2, 1000000}) << '\n';
+
+	// Small indices are stored in a flat array once dense enough
+	dst::tree<int, unsigned short> counts;
+	for(int i = 0; i < 65536; i += 3) counts.apply((unsigned short)i, 1);
+	std::cout << "multiples of 3 below 3000: " << counts.query(0, 2999) << '\n';
+
+#ifdef __SIZEOF_INT128__
+	// Identifiers wider than 64 bits
+	dst::tree<int, dst::uint128> ids;
+	dst::uint128 base = dst::uint128(1) << 100;
+	ids.insert(base, 1);
+	ids.insert(base + 1, 1);
+	ids.insert(base << 20, 1);
+	std::cout << "identifiers near 2^100: " << ids.query(base, base + 1000) << '\n';
+#endif
+}
@@ -0,0 +1,42 @@
+/**
+ * @file mvcc.cpp
+ * @brief Example of mvcc_tree use: transfers committed atomically, audited by transactions that always see the same total.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	using tree = dst::mvcc_tree<long long, int>;
+	using operation = tree::operation;
+
+	tree accounts;
+	for(int account = 0; account < 100; ++account) accounts.insert(account, 1000);
+
+	std::atomic<bool> done(false);
+	std::atomic<int> mismatches(0);
+
+	std::thread auditor([&accounts, &done, &mismatches] {
+		while(!done.load()) {
+			auto transaction = accounts.begin();
+			if(transaction.query(0, 99) != 100000) mismatches.fetch_add(1);
+		}
+	});
+
+	// A transfer debits and credits in one commit, so no transaction sees one without the other
+	for(int transfer = 0; transfer < 10000; ++transfer) {
+		std::vector<operation> commit = {
+			{operation::apply, transfer % 100, -10},
+			{operation::apply, (transfer * 7 + 1) % 100, 10}
+		};
+		accounts.commit(commit.begin(), commit.end());
+	}
+
+	done.store(true);
+	auditor.join();
+
+	std::cout << "mismatches: " << mismatches.load() << ", total: " << accounts.begin().query(0, 99) << '\n';
+}
@@ -0,0 +1,41 @@
+/**
+ * @file predecessor.cpp
+ * @brief Example of bitset_tree use on the Predecessor Problem. Tested on https://judge.yosupo.jp/problem/predecessor_problem
+ */
+
+#include <iostream>
+#include <string>
+#include "dst.hpp"
+
+int main() {
+	std::ios_base::sync_with_stdio(false);
+	std::cin.tie(nullptr);
+
+	int size, query;
+	std::string initial;
+	std::cin >> size >> query >> initial;
+
+	dst::bitset_tree<int> set;
+	for(int i = 0; i < size; ++i) if(initial[i] == '1') set.insert(i);
+
+	while(query--) {
+		int type, index;
+		std::cin >> type >> index;
+
+		if(type == 0) set.insert(index);
+		else if(type == 1) set.erase(index);
+		else if(type == 2) std::cout << set.contains(index) << '\n';
+		else if(type == 3) {
+			int found = -1;
+			set.next(index, found);
+			std::cout << found << '\n';
+		}
+		else {
+			// The last index not greater than the given one is the one ranked just before the next index
+			std::size_t rank = set.rank(index + 1);
+			int found = -1;
+			if(rank > 0) set.select(rank - 1, found);
+			std::cout << found << '\n';
+		}
+	}
+}
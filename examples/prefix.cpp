@@ -0,0 +1,40 @@
+/**
+ * @file prefix.cpp
+ * @brief Example of string_tree use: counting the words of a text by prefix and by lexicographic range.
+ */
+
+#include <iostream>
+#include <string>
+#include "dst.hpp"
+
+int main() {
+	std::ios_base::sync_with_stdio(false);
+	std::cin.tie(nullptr);
+
+	int words, queries;
+	std::cin >> words >> queries;
+
+	dst::string_tree<int> tree;
+
+	while(words--) {
+		std::string word;
+		std::cin >> word;
+		tree.apply(word, 1);
+	}
+
+	while(queries--) {
+		char type;
+		std::cin >> type;
+
+		if(type == 'p') {
+			std::string prefix;
+			std::cin >> prefix;
+			std::cout << tree.query_prefix(prefix) << '\n';
+		}
+		else {
+			std::string start, end;
+			std::cin >> start >> end;
+			std::cout << tree.query(start, end) << '\n';
+		}
+	}
+}
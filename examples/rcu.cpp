@@ -0,0 +1,36 @@
+/**
+ * @file rcu.cpp
+ * @brief Example of rcu_tree use: readers pricing baskets without locks while a writer keeps updating the prices.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	dst::rcu_tree<long long, int> prices;
+	for(int item = 0; item < 1000; ++item) prices.insert(item, 100);
+
+	std::atomic<bool> done(false);
+	std::atomic<long long> quotes(0);
+
+	// Readers never wait for the writer, and see every update whole or not at all
+	std::vector<std::thread> readers;
+	for(int id = 0; id < 3; ++id) {
+		readers.emplace_back([&prices, &done, &quotes, id] {
+			while(!done.load()) {
+				long long basket = prices.query(id * 100, id * 100 + 99);
+				if(basket > 0) quotes.fetch_add(1);
+			}
+		});
+	}
+
+	for(int round = 0; round < 20000; ++round) prices.apply(round % 1000, round % 2 ? 1 : -1);
+
+	done.store(true);
+	for(std::thread& reader : readers) reader.join();
+
+	std::cout << "quotes: " << quotes.load() << ", total price: " << prices.query(0, 999) << '\n';
+}
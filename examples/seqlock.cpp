@@ -0,0 +1,38 @@
+/**
+ * @file seqlock.cpp
+ * @brief Example of seqlock_tree use: readers retrying their queries around a rare writer instead of blocking it.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	dst::seqlock_tree<long long, int> config;
+	for(int key = 0; key < 100; ++key) config.insert(key, 1);
+
+	std::atomic<bool> done(false);
+	std::atomic<long long> reads(0);
+
+	std::vector<std::thread> readers;
+	for(int id = 0; id < 3; ++id) {
+		readers.emplace_back([&config, &done, &reads] {
+			while(!done.load()) {
+				(void)config.query(0, 99);
+				reads.fetch_add(1);
+			}
+		});
+	}
+
+	for(int change = 0; change < 1000; ++change) {
+		config.insert(change % 100, change);
+		std::this_thread::yield();
+	}
+
+	done.store(true);
+	for(std::thread& reader : readers) reader.join();
+
+	std::cout << "reads: " << reads.load() << ", sum: " << config.query(0, 99) << '\n';
+}
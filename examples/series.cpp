@@ -0,0 +1,34 @@
+/**
+ * @file series.cpp
+ * @brief Example of series_tree use: sums over time windows of a stream of timestamped amounts.
+ */
+
+#include <iostream>
+#include "dst.hpp"
+
+int main() {
+	std::ios_base::sync_with_stdio(false);
+	std::cin.tie(nullptr);
+
+	int events;
+	std::cin >> events;
+
+	dst::series_tree<long long, long long> tree;
+
+	// Each event is either an amount at a timestamp, not earlier than the previous one, or a window to sum
+	while(events--) {
+		char type;
+		std::cin >> type;
+
+		if(type == '+') {
+			long long time, amount;
+			std::cin >> time >> amount;
+			if(!tree.apply(time, amount)) std::cout << "out of order\n";
+		}
+		else {
+			long long start, end;
+			std::cin >> start >> end;
+			std::cout << tree.query(start, end) << '\n';
+		}
+	}
+}
@@ -0,0 +1,28 @@
+/**
+ * @file sharded.cpp
+ * @brief Example of sharded_tree use: regions written by threads of their own, with queries spanning every shard.
+ */
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "dst.hpp"
+
+int main() {
+	// One shard per region of a million sensors, so that the writers of different regions never contend
+	std::vector<int> splits = {1000000, 2000000, 3000000};
+	dst::sharded_tree<long long, int> readings(splits);
+
+	std::vector<std::thread> regions;
+	for(int region = 0; region < 4; ++region) {
+		regions.emplace_back([&readings, region] {
+			for(int sensor = 0; sensor < 100000; ++sensor) readings.insert(region * 1000000 + sensor, sensor % 10);
+		});
+	}
+
+	for(std::thread& region : regions) region.join();
+
+	std::cout << "shards: " << readings.shards() << '\n';
+	std::cout << "region 2: " << readings.query(2000000, 2999999) << '\n';
+	std::cout << "everything: " << readings.query(0, 3999999) << '\n';
+}
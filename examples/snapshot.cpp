@@ -0,0 +1,26 @@
+/**
+ * @file snapshot.cpp
+ * @brief Example of snapshot_tree use: a report computed on a frozen view while the balances keep changing.
+ */
+
+#include <iostream>
+#include <thread>
+#include "dst.hpp"
+
+int main() {
+	dst::snapshot_tree<long long, int> balances;
+	for(int account = 0; account < 1000; ++account) balances.insert(account, 100);
+
+	auto view = balances.snapshot();
+
+	std::thread teller([&balances] {
+		for(int transfer = 0; transfer < 10000; ++transfer) balances.apply(transfer % 1000, 5);
+	});
+
+	// The view keeps the balances of the time it was taken, whatever the teller does meanwhile
+	long long first = view.query(0, 499), second = view.query(500, 999);
+	teller.join();
+
+	std::cout << "report: " << first + second << '\n';
+	std::cout << "now: " << balances.query(0, 999) << '\n';
+}
@@ -0,0 +1,471 @@
+/**
+ * @file stress.cpp
+ * @brief Stress test comparing the trees to std::map under random operations.
+ *
+ * Meant to be run under the sanitizers as well, for instance with ThreadSanitizer:
+ *
+ *     g++ -std=c++17 -O1 -g -fsanitize=thread -pthread -I.. stress.cpp -o stress && ./stress 2000
+ *
+ * The argument is the amount of operations per round, and the program exits with 1 on the first mismatch. Besides sums,
+ * the trees are checked with maxima and minima over values of both signs, which tell a default value aggregated for a
+ * missing index from a real one.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "dst.hpp"
+
+namespace {
+
+struct maximum {
+	long long operator()(long long a, long long b) const { return std::max(a, b); }
+};
+
+struct minimum {
+	long long operator()(long long a, long long b) const { return std::min(a, b); }
+};
+
+void check(bool condition, const char* what) {
+	if(condition) return;
+
+	std::cerr << "mismatch: " << what << '\n';
+	std::exit(1);
+}
+
+/**
+ * @brief The aggregate of the values of a map in a range, the first one found starting it, and zero if there is none.
+ */
+template<class _functor = std::plus<long long>, typename _tindex>
+long long fold(const std::map<_tindex, long long>& map, const _tindex& start, const _tindex& end) {
+	long long result = 0;
+	bool found = false;
+
+	for(auto it = map.lower_bound(start); it != map.end() && !(end < it->first); ++it) {
+		result = found ? _functor()(result, it->second) : it->second;
+		found = true;
+	}
+
+	return result;
+}
+
+/**
+ * @brief Aggregate a value to an index of a map as the trees do, inserting it if the index is missing.
+ */
+template<class _functor, typename _tindex>
+void merge(std::map<_tindex, long long>& map, const _tindex& at, long long value) {
+	auto found = map.find(at);
+	if(found == map.end()) map.emplace(at, value);
+	else found->second = _functor()(found->second, value);
+}
+
+long long get(long long value) { return value; }
+long long get(std::future<long long> value) { return value.get(); }
+
+/**
+ * @brief Make the writes of every thread visible to the queries, which only the buffered trees need.
+ */
+template<class _tree>
+void settle(_tree&) {}
+
+template<typename _tvalue, typename _tindex, class _functor>
+void settle(dst::buffered_tree<_tvalue, _tindex, _functor>& tree) { tree.flush(); }
+
+/**
+ * @brief Random insertions, additions, erasures and queries on a tree with the interface of tree, checked against a map.
+ */
+template<class _tree, class _functor, typename _tindex, class _generator>
+void mirrored(_tree& tree, std::map<_tindex, long long>& map, int operations, std::mt19937_64& rng, _generator index,
+	const char* name) {
+
+	for(int i = 0; i < operations; ++i) {
+		_tindex at = index(rng);
+		long long value = (long long)(rng() % 1000) - 500;
+
+		switch(rng() % 5) {
+		case 0: tree.insert(at, value); map[at] = value; break;
+		case 1: tree.apply(at, value); merge<_functor>(map, at, value); break;
+		case 2: tree.erase(at); map.erase(at); break;
+		case 3: {
+			_tindex other = index(rng);
+			if(other < at) std::swap(at, other);
+			check(tree.query(at, other) == fold<_functor>(map, at, other), name);
+			break;
+		}
+		default: check(tree[at] == (map.count(at) ? map[at] : 0), name);
+		}
+	}
+
+	check(map.empty() || tree.query(map.begin()->first, map.rbegin()->first) ==
+		fold<_functor>(map, map.begin()->first, map.rbegin()->first), name);
+}
+
+/**
+ * @brief The random operations of mirrored on a tree, with batches as well.
+ */
+template<typename _tindex, class _functor = std::plus<long long>, class _generator>
+void sequential(int operations, std::mt19937_64& rng, _generator index) {
+	dst::tree<long long, _tindex, _functor> tree;
+	std::map<_tindex, long long> map;
+
+	using operation = typename dst::tree<long long, _tindex, _functor>::operation;
+
+	for(int round = 0; round < 8; ++round) {
+		mirrored<decltype(tree), _functor>(tree, map, operations / 8, rng, index, "tree");
+
+		std::vector<operation> batch;
+		for(int j = 0; j < 64; ++j) {
+			_tindex near = index(rng);
+			long long value = (long long)(rng() % 1000) - 500;
+
+			if(rng() % 4) {
+				batch.push_back(operation{operation::apply, near, value});
+				merge<_functor>(map, near, value);
+			}
+			else {
+				batch.push_back(operation{operation::erase, near, 0});
+				map.erase(near);
+			}
+		}
+
+		tree.batch(batch.begin(), batch.end());
+	}
+
+	check(map.empty() || tree.query(map.begin()->first, map.rbegin()->first) ==
+		fold<_functor>(map, map.begin()->first, map.rbegin()->first), "tree batch");
+}
+
+/**
+ * @brief The random operations of mirrored on one of the other trees with the interface of tree.
+ */
+template<class _tree, class _functor = std::plus<long long>, class _generator>
+void alike(int operations, std::mt19937_64& rng, _generator index, const char* name) {
+	using _tindex = decltype(index(rng));
+
+	_tree tree;
+	std::map<_tindex, long long> map;
+	mirrored<_tree, _functor>(tree, map, operations, rng, index, name);
+}
+
+/**
+ * @brief Appends and additions to a series tree, checked against a map.
+ */
+template<class _functor>
+void series(int operations, std::mt19937_64& rng) {
+	dst::series_tree<long long, long long, _functor> tree;
+	std::map<long long, long long> map;
+	long long last = 0;
+
+	for(int i = 0; i < operations; ++i) {
+		long long value = (long long)(rng() % 1000) - 500;
+
+		if(rng() % 3) {
+			last += (long long)(rng() % 4);
+			check(tree.insert(last, value), "series_tree insert");
+			map[last] = value;
+		}
+		else {
+			long long at = (long long)(rng() % (last + 2));
+			bool known = map.count(at) || at >= last;
+
+			check(tree.apply(at, value) == known, "series_tree apply");
+			if(known) merge<_functor>(map, at, value);
+			last = std::max(last, at);
+		}
+
+		long long start = (long long)(rng() % (last + 2)), end = (long long)(rng() % (last + 2));
+		if(end < start) std::swap(start, end);
+		check(tree.query(start, end) == fold<_functor>(map, start, end), "series_tree query");
+	}
+}
+
+/**
+ * @brief Insertions and erasures in a bitset tree, its counts, ranks and searches checked against a set.
+ */
+void bitset(int operations, std::mt19937_64& rng) {
+	dst::bitset_tree<long long> tree;
+	std::set<long long> set;
+
+	for(int i = 0; i < operations; ++i) {
+		long long at = (long long)(rng() % 5000) - 2500, other = (long long)(rng() % 5000) - 2500;
+		if(other < at) std::swap(at, other);
+
+		if(rng() % 3) { tree.insert(at); set.insert(at); }
+		else { tree.erase(at); set.erase(at); }
+
+		check(tree.contains(other) == (set.count(other) > 0), "bitset_tree contains");
+		check(tree.count() == set.size(), "bitset_tree count");
+		check(tree.count(at, other) == std::size_t(std::distance(set.lower_bound(at), set.upper_bound(other))),
+			"bitset_tree range count");
+
+		std::size_t rank = tree.rank(other);
+		check(rank == std::size_t(std::distance(set.begin(), set.lower_bound(other))), "bitset_tree rank");
+
+		long long found = 0;
+		check(tree.select(rank, found) == (rank < set.size()) && (rank == set.size() || found == *set.lower_bound(other)),
+			"bitset_tree select");
+		check(tree.next(at, found) == (set.lower_bound(at) != set.end()) &&
+			(set.lower_bound(at) == set.end() || found == *set.lower_bound(at)), "bitset_tree next");
+	}
+}
+
+/**
+ * @brief The operations of tree running on a thread pool, checked against a map.
+ */
+void pooled(int operations, std::mt19937_64& rng) {
+	dst::thread_pool pool(4);
+	std::map<long long, long long> map;
+	std::vector<std::pair<long long, long long>> entries;
+
+	for(int i = 0; i < operations; ++i) {
+		long long at = (long long)(rng() % (8 * operations)), value = (long long)(rng() % 100);
+		map[at] = value;
+		entries.emplace_back(at, value);
+	}
+
+	dst::tree<long long, long long> tree;
+	tree.build(entries.begin(), entries.end(), pool);
+
+	std::vector<std::pair<long long, long long>> visited;
+	tree.parallel_for_each(0, 8 * operations, [&visited](long long at, long long value) { visited.emplace_back(at, value); },
+		pool, dst::tree<long long, long long>::ordered);
+	check(visited == std::vector<std::pair<long long, long long>>(map.begin(), map.end()), "ordered visit");
+
+	std::atomic<long long> total(0);
+	tree.parallel_for_each(0, 8 * operations, [&total](long long, long long value) { total += value; }, pool);
+	check(total.load() == fold(map, 0ll, 8ll * operations), "unordered visit");
+
+	// Products of 2x2 matrices, which do not commute, so the chunks must be combined in order
+	using matrix = std::vector<long long>;
+	struct product {
+		matrix operator()(const matrix& a, const matrix& b) const {
+			if(a.empty()) return b;
+			if(b.empty()) return a;
+			return {(a[0] * b[0] + a[1] * b[2]) % 1009, (a[0] * b[1] + a[1] * b[3]) % 1009,
+				(a[2] * b[0] + a[3] * b[2]) % 1009, (a[2] * b[1] + a[3] * b[3]) % 1009};
+		}
+	};
+
+	dst::tree<matrix, long long, product> matrices;
+	for(const auto& entry : map) matrices.insert(entry.first, {entry.second, 1, 1, 0});
+	check(matrices.query(0, 8 * operations, pool, 2) == matrices.query(0, 8 * operations), "parallel query");
+}
+
+/**
+ * @brief Threads writing disjoint indices of a concurrent tree while others query it, checked against a map afterwards.
+ *
+ * Trees whose insertions keep an existing value, as atomic_tree, are only given additions.
+ */
+template<class _tree, class _functor = std::plus<long long>>
+void concurrent(int operations, const char* name, bool inserts = true) {
+	_tree tree;
+	std::vector<std::map<long long, long long>> maps(4);
+	std::vector<std::thread> threads;
+
+	for(int id = 0; id < 4; ++id) {
+		threads.emplace_back([&tree, &maps, operations, id, inserts] {
+			std::mt19937_64 rng(id);
+
+			for(int i = 0; i < operations; ++i) {
+				long long at = (long long)(rng() % 1000) * 4 + id, value = (long long)(rng() % 100) - 50;
+
+				if(!inserts || rng() % 2) { tree.apply(at, value); merge<_functor>(maps[id], at, value); }
+				else { tree.insert(at, value); maps[id][at] = value; }
+			}
+		});
+	}
+
+	threads.emplace_back([&tree, operations] {
+		for(int i = 0; i < operations; ++i) (void)get(tree.query(0, 4000));
+	});
+
+	for(std::thread& thread : threads) thread.join();
+	settle(tree);
+
+	std::map<long long, long long> map;
+	for(const auto& part : maps) map.insert(part.begin(), part.end());
+
+	for(const auto& entry : map) check(get(tree.query(entry.first, entry.first)) == entry.second, name);
+	check(get(tree.query(0, 4000)) == fold<_functor>(map, 0ll, 4000ll), name);
+	check(get(tree.query(1000, 2000)) == fold<_functor>(map, 1000ll, 2000ll), name);
+}
+
+/**
+ * @brief Threads querying views of a snapshot tree while its single writer keeps changing it.
+ */
+void views(int operations, std::mt19937_64& rng) {
+	dst::snapshot_tree<long long, long long> tree;
+	std::map<long long, long long> map;
+
+	for(long long at = 0; at < 1000; ++at) {
+		tree.insert(at, at);
+		map[at] = at;
+	}
+
+	auto view = tree.snapshot();
+	std::map<long long, long long> frozen = map;
+	std::vector<std::thread> readers;
+
+	for(int id = 0; id < 3; ++id) {
+		readers.emplace_back([&view, &frozen, operations, id] {
+			std::mt19937_64 local(id);
+
+			for(int i = 0; i < operations; ++i) {
+				long long start = (long long)(local() % 1000), end = start + (long long)(local() % 100);
+				check(view.query(start, end) == fold(frozen, start, end), "snapshot_tree view");
+			}
+		});
+	}
+
+	for(int i = 0; i < operations; ++i) {
+		long long at = (long long)(rng() % 1200), value = (long long)(rng() % 100);
+
+		if(rng() % 3 == 0) { tree.erase(at); map.erase(at); }
+		else { tree.apply(at, value); map[at] += value; }
+	}
+
+	for(std::thread& reader : readers) reader.join();
+
+	check(tree.query(0, 1200) == fold(map, 0ll, 1200ll), "snapshot_tree");
+	check(view.query(0, 1200) == fold(frozen, 0ll, 1200ll), "snapshot_tree view");
+}
+
+/**
+ * @brief Writes to a versioned tree, every past version then checked against a copy of the map taken at the time.
+ */
+template<class _functor>
+void versions(int operations, std::mt19937_64& rng) {
+	dst::versioned_tree<long long, long long, _functor> tree;
+	std::map<long long, long long> map;
+	std::vector<std::pair<std::size_t, std::map<long long, long long>>> kept;
+
+	for(int i = 0; i < operations; ++i) {
+		long long at = (long long)(rng() % 2000) - 1000, value = (long long)(rng() % 1000) - 500;
+		std::size_t version;
+
+		switch(rng() % 3) {
+		case 0: version = tree.insert(at, value); map[at] = value; break;
+		case 1: version = tree.apply(at, value); merge<_functor>(map, at, value); break;
+		default: version = tree.erase(at); map.erase(at);
+		}
+
+		if(i % 64 == 0) kept.emplace_back(version, map);
+	}
+
+	for(const auto& past : kept) {
+		for(int i = 0; i < 16; ++i) {
+			long long start = (long long)(rng() % 2000) - 1000, end = (long long)(rng() % 2000) - 1000;
+			if(end < start) std::swap(start, end);
+
+			check(tree.query_at(past.first, start, end) == fold<_functor>(past.second, start, end), "versioned_tree");
+			check(tree.at(past.first, start) == (past.second.count(start) ? past.second.at(start) : 0), "versioned_tree");
+		}
+	}
+}
+
+/**
+ * @brief Commits to an mvcc tree while threads run transactions, each checking that its version never changes.
+ */
+template<class _functor>
+void transactions(int operations, std::mt19937_64& rng) {
+	dst::mvcc_tree<long long, long long, _functor> tree;
+	using operation = typename dst::tree<long long, long long, _functor>::operation;
+
+	std::atomic<bool> done(false);
+	std::vector<std::thread> readers;
+
+	for(int id = 0; id < 3; ++id) {
+		readers.emplace_back([&tree, &done] {
+			while(!done.load()) {
+				auto transaction = tree.begin();
+				long long first = transaction.query(-1000, 1000);
+
+				for(int i = 0; i < 16; ++i) check(transaction.query(-1000, 1000) == first, "mvcc_tree transaction");
+			}
+		});
+	}
+
+	std::map<long long, long long> map;
+
+	for(int i = 0; i < operations; ++i) {
+		// Commits of several operations, each holding values which would tell a partial commit apart
+		std::vector<operation> commit;
+
+		for(int j = 0; j < 4; ++j) {
+			long long at = (long long)(rng() % 2000) - 1000, value = (long long)(rng() % 1000) - 500;
+
+			if(rng() % 4) { commit.push_back(operation{operation::apply, at, value}); merge<_functor>(map, at, value); }
+			else { commit.push_back(operation{operation::erase, at, 0}); map.erase(at); }
+		}
+
+		tree.commit(commit.begin(), commit.end());
+
+		auto transaction = tree.begin();
+		long long start = (long long)(rng() % 2000) - 1000, end = (long long)(rng() % 2000) - 1000;
+		if(end < start) std::swap(start, end);
+		check(transaction.query(start, end) == fold<_functor>(map, start, end), "mvcc_tree");
+	}
+
+	done = true;
+	for(std::thread& reader : readers) reader.join();
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	int operations = argc > 1 ? std::atoi(argv[1]) : 20000;
+	std::mt19937_64 rng(42);
+
+	auto small = [](std::mt19937_64& r) { return (long long)(r() % 2000) - 1000; };
+	auto spread = [](std::mt19937_64& r) { return (long long)(r() % 64) << 56; };
+	auto word = [](std::mt19937_64& r) {
+		std::string result;
+		for(std::size_t length = r() % 5; length > 0; --length) result += char('a' + r() % 3);
+		return result;
+	};
+
+	sequential<long long>(operations, rng, small);
+	sequential<long long>(operations, rng, spread);
+	sequential<double>(operations, rng, [](std::mt19937_64& r) { return double((long long)(r() % 2000) - 1000) / 8; });
+	sequential<unsigned short>(operations, rng, [](std::mt19937_64& r) { return (unsigned short)r(); });
+	sequential<std::pair<int, int>>(operations, rng, [](std::mt19937_64& r) { return std::make_pair(int(r() % 30), int(r() % 30) - 15); });
+	sequential<long long, maximum>(operations, rng, small);
+	sequential<unsigned short, minimum>(operations, rng, [](std::mt19937_64& r) { return (unsigned short)(r() % 3000); });
+
+	alike<dst::string_tree<long long>>(operations, rng, word, "string_tree");
+	alike<dst::string_tree<long long, maximum>, maximum>(operations, rng, word, "string_tree");
+	alike<dst::radix_tree<long long, long long>>(operations, rng, spread, "radix_tree");
+	alike<dst::radix_tree<long long, long long, minimum>, minimum>(operations, rng, small, "radix_tree");
+	alike<dst::adaptive_tree<long long, long long>>(operations, rng, small, "adaptive_tree");
+	alike<dst::adaptive_tree<long long, long long, maximum>, maximum>(operations, rng, small, "adaptive_tree");
+	series<std::plus<long long>>(operations, rng);
+	series<maximum>(operations, rng);
+	bitset(operations, rng);
+
+	pooled(operations, rng);
+
+	concurrent<dst::concurrent_tree<long long, long long>>(operations, "concurrent_tree");
+	concurrent<dst::rcu_tree<long long, long long, maximum>, maximum>(operations, "rcu_tree");
+	concurrent<dst::atomic_tree<long long, long long>>(operations, "atomic_tree", false);
+	concurrent<dst::counter_tree<long long, long long>>(operations, "counter_tree");
+	concurrent<dst::combining_tree<long long, long long>>(operations, "combining_tree");
+	concurrent<dst::delegated_tree<long long, long long, minimum>, minimum>(operations, "delegated_tree");
+	concurrent<dst::buffered_tree<long long, long long>>(operations, "buffered_tree");
+	concurrent<dst::seqlock_tree<long long, long long, maximum>, maximum>(operations, "seqlock_tree");
+	concurrent<dst::sharded_tree<long long, long long, minimum>, minimum>(operations, "sharded_tree");
+	views(operations, rng);
+	versions<maximum>(operations, rng);
+	transactions<std::plus<long long>>(operations / 4, rng);
+	transactions<minimum>(operations / 4, rng);
+
+	std::cout << "ok" << '\n';
+}
@@ -0,0 +1,37 @@
+/**
+ * @file versioned.cpp
+ * @brief Example of versioned_tree use: range sums over the past versions of an array.
+ *
+ * Each line either adds a value at an index, which creates a version, or asks for the sum of a range as of a version.
+ */
+
+#include <iostream>
+#include "dst.hpp"
+
+int main() {
+	std::ios_base::sync_with_stdio(false);
+	std::cin.tie(nullptr);
+
+	int query;
+	std::cin >> query;
+
+	dst::versioned_tree<long long, int> tree;
+
+	while(query--) {
+		int type;
+		std::cin >> type;
+
+		if(type) {
+			std::size_t version;
+			int start, end;
+			std::cin >> version >> start >> end;
+			std::cout << tree.query_at(version, start, end) << '\n';
+		}
+		else {
+			int index;
+			long long value;
+			std::cin >> index >> value;
+			std::cout << "version " << tree.apply(index, value) << '\n';
+		}
+	}
+}